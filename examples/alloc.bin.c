@@ -0,0 +1,105 @@
+#include "nitro.h"
+#include <unistd.h>
+
+/* Count heap allocations made during request/reply round trips.  Build the
+   library with -DNITRO_POOL_DISABLE to compare against plain malloc/free. */
+
+static uint64_t mallocs;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+
+void *malloc(size_t size) {
+    __sync_fetch_and_add(&mallocs, 1);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    __sync_fetch_and_add(&mallocs, 1);
+    return __libc_calloc(n, size);
+}
+#endif
+
+static int round_trip(nitro_socket_t *r, nitro_socket_t *c, int count) {
+    int i;
+
+    for (i=0; i < count; i++) {
+        nitro_frame_t *fr = nitro_frame_new_copy(&i, sizeof(int));
+        nitro_send(&fr, c, 0);
+
+        fr = nitro_recv(r, 0);
+        if (*(int*)nitro_frame_data(fr) != i) {
+            nitro_frame_destroy(fr);
+            break;
+        }
+
+        nitro_frame_t *back = nitro_frame_new_copy(&i, sizeof(int));
+        nitro_reply(fr, &back, r, 0);
+        nitro_frame_destroy(fr);
+
+        fr = nitro_recv(c, 0);
+        if (*(int*)nitro_frame_data(fr) != i) {
+            nitro_frame_destroy(fr);
+            break;
+        }
+        nitro_frame_destroy(fr);
+    }
+
+    return i;
+}
+
+static void run(char *name, char *location, int secure, int count) {
+    nitro_sockopt_t *ropt = nitro_sockopt_new();
+    nitro_sockopt_t *copt = nitro_sockopt_new();
+    nitro_sockopt_set_secure(ropt, secure);
+    nitro_sockopt_set_secure(copt, secure);
+
+    nitro_socket_t *r = nitro_socket_bind(location, ropt);
+    nitro_socket_t *c = nitro_socket_connect(location, copt);
+
+    /* warm up: connect, handshake, fill the pools */
+    round_trip(r, c, 1000);
+
+    uint64_t frames = nitro_frame_pool.stat_slabs;
+    uint64_t cbufs = nitro_cbuffer_pool.stat_slabs;
+    uint64_t base = __sync_fetch_and_add(&mallocs, 0);
+    double start = now_double();
+
+    int done = round_trip(r, c, count);
+
+    double delt = now_double() - start;
+    uint64_t n = __sync_fetch_and_add(&mallocs, 0) - base;
+
+    fprintf(stderr, "{alloc} %-6s %d round trips in %.3f seconds (%d/s), "
+            "%.2f mallocs/message, %llu new slabs\n",
+            name, done, delt, (int)(done / delt),
+            (double)n / (done * 2),
+            (unsigned long long)(nitro_frame_pool.stat_slabs - frames +
+                nitro_cbuffer_pool.stat_slabs - cbufs));
+
+    nitro_socket_close(c);
+    nitro_socket_close(r);
+}
+
+int main(int argc, char **argv) {
+
+    if (argc != 2) {
+        fprintf(stderr, "one argument: ROUND_TRIPS\n");
+        return -1;
+    }
+
+    int count = atoi(argv[1]);
+    nitro_runtime_start();
+
+    run("tcp", "tcp://127.0.0.1:4451", 0, count);
+    run("secure", "tcp://127.0.0.1:4452", 1, count);
+    run("inproc", "inproc://alloc", 0, count);
+
+    /* linger */
+    sleep(2);
+
+    nitro_runtime_stop();
+
+    return 0;
+}
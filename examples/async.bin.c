@@ -0,0 +1,64 @@
+#include "nitro.h"
+#include <unistd.h>
+
+#define PRODUCERS 16
+
+static int COMMANDS;
+
+void *do_schedule(void *baton) {
+    nitro_loop_t *l = (nitro_loop_t *)baton;
+    int i;
+
+    for (i=0; i < COMMANDS; ++i) {
+        nitro_async_t a = {NITRO_ASYNC_NOOP};
+        nitro_async_schedule(&a, l);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+
+    if (argc != 2) {
+        fprintf(stderr, "one argument: COMMANDS_PER_THREAD\n");
+        return -1;
+    }
+
+    COMMANDS = atoi(argv[1]);
+    nitro_runtime_start();
+
+    nitro_loop_t *l = &the_runtime->loops[0];
+    uint64_t total = (uint64_t)COMMANDS * PRODUCERS;
+    uint64_t base = __atomic_load_n(&l->async_ring.handled, __ATOMIC_ACQUIRE);
+
+    pthread_t kids[PRODUCERS];
+    void *res;
+    int i;
+
+    struct timeval mark;
+    gettimeofday(&mark, NULL);
+    double start = ((double)mark.tv_sec +
+        (mark.tv_usec / 1000000.0));
+
+    for (i=0; i < PRODUCERS; ++i) {
+        pthread_create(&kids[i], NULL, do_schedule, l);
+    }
+    for (i=0; i < PRODUCERS; ++i) {
+        pthread_join(kids[i], &res);
+    }
+
+    while (__atomic_load_n(&l->async_ring.handled, __ATOMIC_ACQUIRE) - base < total) {
+        usleep(100);
+    }
+
+    gettimeofday(&mark, NULL);
+    double delt = ((double)mark.tv_sec +
+        (mark.tv_usec / 1000000.0)) - start;
+
+    fprintf(stderr, "{async} %d threads, %llu commands in %.3f seconds (%d/s)\n",
+        PRODUCERS, (unsigned long long)total, delt, (int)(total / delt));
+
+    nitro_runtime_stop();
+
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include "nitro.h"
+#include "compress.h"
+#include <unistd.h>
+
+/* Throughput against compression ratio: the same TCP stream
+   sent raw and deflated, for JSON-like and random payloads. */
+
+static int MESSAGES;
+
+struct test_state {
+    nitro_socket_t *s_r;
+    nitro_socket_t *s_s;
+    char *body;
+    int size;
+    double start;
+    double end;
+};
+
+void *do_recv(void *baton) {
+    struct test_state *ts = (struct test_state *)baton;
+
+    int i;
+    for (i=0; i < MESSAGES; ++i) {
+        nitro_frame_t *fr = nitro_recv(ts->s_r, 0);
+        nitro_frame_destroy(fr);
+    }
+    ts->end = now_double();
+
+    return NULL;
+}
+
+void *do_send(void *baton) {
+    struct test_state *ts = (struct test_state *)baton;
+
+    sleep(1);
+    nitro_frame_t *out = nitro_frame_new_copy(ts->body, ts->size);
+
+    ts->start = now_double();
+    int i;
+    for (i=0; i < MESSAGES; ++i) {
+        nitro_send(&out, ts->s_s, NITRO_REUSE);
+    }
+
+    nitro_frame_destroy(out);
+    return NULL;
+}
+
+static void fill_json(char *buf, int size) {
+    int n = 0;
+
+    while (n < size) {
+        char rec[128];
+        int len = snprintf(rec, sizeof(rec),
+            "{\"id\": %d, \"user\": \"user%d\", \"score\": %.2f, "
+            "\"tags\": [\"alpha\", \"beta\"]}, ",
+            (int)random() % 100000, (int)random() % 1000,
+            (random() % 10000) / 100.0);
+        memcpy(buf + n, rec, len < size - n ? len : size - n);
+        n += len;
+    }
+}
+
+static void fill_random(char *buf, int size) {
+    int i;
+    for (i=0; i < size; i++) {
+        buf[i] = random();
+    }
+}
+
+static void run(char *kind, char *body, int size, int threshold, int port) {
+    char location[64];
+    snprintf(location, sizeof(location), "tcp://127.0.0.1:%d", port);
+
+    nitro_sockopt_t *opt = nitro_sockopt_new();
+    nitro_sockopt_set_compress(opt, threshold);
+
+    nitro_socket_t *r = nitro_socket_bind(location, NULL);
+    nitro_socket_t *c = nitro_socket_connect(location, opt);
+
+    struct test_state ts = {r, c, body, size, 0, 0};
+    pthread_t t1, t2;
+    void *res;
+
+    pthread_create(&t1, NULL, do_recv, &ts);
+    pthread_create(&t2, NULL, do_send, &ts);
+    pthread_join(t1, &res);
+    pthread_join(t2, &res);
+
+    /* what one payload costs on the wire */
+    nitro_frame_t *fr = nitro_frame_new_copy(body, size);
+    if (threshold && size > threshold) {
+        fr = compress_frame(fr);
+    }
+    double ratio = (double)size / nitro_frame_size(fr);
+    nitro_frame_destroy(fr);
+
+    double delt = ts.end - ts.start;
+    fprintf(stderr, "{compress} %-6s %6d bytes %-3s  ratio %5.2f  "
+        "%8d msg/s  %7.1f MB/s payload  %7.1f MB/s wire\n",
+        kind, size, threshold ? "on" : "off", ratio,
+        (int)(MESSAGES / delt),
+        MESSAGES * (double)size / delt / (1024 * 1024),
+        MESSAGES * (double)size / ratio / delt / (1024 * 1024));
+
+    nitro_socket_close(c);
+    nitro_socket_close(r);
+}
+
+int main(int argc, char **argv) {
+
+    if (argc != 2) {
+        fprintf(stderr, "one argument: MESSAGE_COUNT\n");
+        return -1;
+    }
+
+    MESSAGES = atoi(argv[1]);
+    nitro_runtime_start();
+
+    int sizes[] = {512, 4096, 65536};
+    int port = 4460;
+    int i, on;
+
+    for (i=0; i < sizeof(sizes) / sizeof(int); i++) {
+        char *body = malloc(sizes[i]);
+
+        fill_json(body, sizes[i]);
+        for (on=0; on < 2; on++) {
+            run("json", body, sizes[i], on ? 256 : 0, port++);
+        }
+
+        fill_random(body, sizes[i]);
+        for (on=0; on < 2; on++) {
+            run("random", body, sizes[i], on ? 256 : 0, port++);
+        }
+
+        free(body);
+    }
+
+    /* linger */
+    sleep(2);
+
+    nitro_runtime_stop();
+
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "nitro.h"
+#include <sys/resource.h>
+
+#define CONSUMERS 32
+
+static int MESSAGES;
+static int taken;
+
+void *do_consume(void *baton) {
+    nitro_queue_t *q = (nitro_queue_t *)baton;
+
+    while (1) {
+        nitro_frame_t *fr = nitro_queue_pull(q, 1);
+        int done = *(int *)nitro_frame_data(fr) < 0;
+        nitro_frame_destroy(fr);
+
+        if (done) {
+            break;
+        }
+
+        __sync_fetch_and_add(&taken, 1);
+    }
+
+    return NULL;
+}
+
+static long switches() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+int main(int argc, char **argv) {
+
+    if (argc != 2) {
+        fprintf(stderr, "one argument: MESSAGES\n");
+        return -1;
+    }
+
+    MESSAGES = atoi(argv[1]);
+    nitro_runtime_start();
+
+    nitro_queue_t *q = nitro_queue_new(0, NULL, NULL);
+    pthread_t kids[CONSUMERS];
+    void *res;
+    int i;
+
+    for (i=0; i < CONSUMERS; ++i) {
+        pthread_create(&kids[i], NULL, do_consume, q);
+    }
+
+    /* let everyone block on the empty queue */
+    sleep(1);
+
+    long base = switches();
+    double start = now_double();
+
+    for (i=0; i < MESSAGES; ++i) {
+        nitro_queue_push(q, nitro_frame_new_copy(&i, sizeof(int)), 1);
+
+        /* a trickle, so consumers are parked between messages */
+        usleep(20);
+    }
+
+    while (__sync_fetch_and_add(&taken, 0) < MESSAGES) {
+        usleep(100);
+    }
+
+    double delt = now_double() - start;
+    long csw = switches() - base;
+
+    fprintf(stderr, "{herd} %d consumers, %d messages in %.3f seconds (%d/s), "
+            "%.2f context switches/message, %.2f wakeups/message\n",
+            CONSUMERS, MESSAGES, delt, (int)(MESSAGES / delt),
+            (double)csw / MESSAGES, (double)q->stat_wakeups / MESSAGES);
+
+    for (i=0; i < CONSUMERS; ++i) {
+        int stop = -1;
+        nitro_queue_push(q, nitro_frame_new_copy(&stop, sizeof(int)), 1);
+    }
+    for (i=0; i < CONSUMERS; ++i) {
+        pthread_join(kids[i], &res);
+    }
+
+    nitro_queue_destroy(q);
+    nitro_runtime_stop();
+
+    return 0;
+}
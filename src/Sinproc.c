@@ -64,8 +64,9 @@ void Sinproc_socket_recv_queue_stat(NITRO_QUEUE_STATE st, NITRO_QUEUE_STATE last
  * Create the global in queue associated with a socket
  */
 void Sinproc_create_queues(nitro_inproc_socket_t *s) {
-    s->q_recv = nitro_queue_new(
-                    s->opt->hwm_in, Sinproc_socket_recv_queue_stat, (void *)s);
+    s->q_recv = nitro_socket_queue_new(s->opt,
+                    s->opt->hwm_in, s->opt->hwm_bytes_in, 0, &s->stat_expired,
+                    Sinproc_socket_recv_queue_stat, (void *)s);
 }
 
 void Sinproc_socket_destroy(nitro_inproc_socket_t *s) {
@@ -125,19 +126,19 @@ int Sinproc_socket_connect(nitro_inproc_socket_t *s, char *location) {
 
     Sinproc_create_queues(s);
 
-    pthread_mutex_lock(&the_runtime->l_inproc);
+    pthread_mutex_lock(&s->runtime->l_inproc);
     nitro_inproc_socket_t *match;
 
-    HASH_FIND(hh, the_runtime->inprocs, location, strlen(location), match);
+    HASH_FIND(hh, s->runtime->inprocs, location, strlen(location), match);
 
     if (!match) {
-        pthread_mutex_unlock(&the_runtime->l_inproc);
+        pthread_mutex_unlock(&s->runtime->l_inproc);
         return nitro_set_error(NITRO_ERR_INPROC_NOT_BOUND);
     }
 
     pthread_rwlock_init(&s->link_lock, NULL);
     Sinproc_socket_bound_add_conn(match, s);
-    pthread_mutex_unlock(&the_runtime->l_inproc);
+    pthread_mutex_unlock(&s->runtime->l_inproc);
 
     return 0;
 }
@@ -154,7 +155,7 @@ int Sinproc_socket_bind(nitro_inproc_socket_t *s, char *location) {
 
     Sinproc_create_queues(s);
 
-    pthread_mutex_lock(&the_runtime->l_inproc);
+    pthread_mutex_lock(&s->runtime->l_inproc);
     nitro_inproc_socket_t *match;
 
     s->bound = 1;
@@ -162,21 +163,21 @@ int Sinproc_socket_bind(nitro_inproc_socket_t *s, char *location) {
     pthread_rwlock_init(&s->link_lock, NULL);
     s->current = NULL;
 
-    HASH_FIND(hh, the_runtime->inprocs, location, strlen(location), match);
+    HASH_FIND(hh, s->runtime->inprocs, location, strlen(location), match);
 
     if (match) {
-        pthread_mutex_unlock(&the_runtime->l_inproc);
+        pthread_mutex_unlock(&s->runtime->l_inproc);
         return nitro_set_error(NITRO_ERR_INPROC_ALREADY_BOUND);
     }
 
-    HASH_ADD_KEYPTR(hh, the_runtime->inprocs,
+    HASH_ADD_KEYPTR(hh, s->runtime->inprocs,
                     s->given_location,
                     strlen(s->given_location),
                     s);
-    HASH_FIND(hh, the_runtime->inprocs, location, strlen(location), match);
+    HASH_FIND(hh, s->runtime->inprocs, location, strlen(location), match);
     assert(match == s);
 
-    pthread_mutex_unlock(&the_runtime->l_inproc);
+    pthread_mutex_unlock(&s->runtime->l_inproc);
     return 0;
 }
 
@@ -203,11 +204,13 @@ void Sinproc_socket_start_shutdown(nitro_inproc_socket_t *s) {
 
 void Sinproc_socket_close(nitro_inproc_socket_t *s) {
     nitro_counted_buffer_t *cleanup = NULL;
-    pthread_mutex_lock(&the_runtime->l_inproc);
+    /* a connected socket is freed before the unlock */
+    nitro_runtime_t *rt = s->runtime;
+    pthread_mutex_lock(&rt->l_inproc);
     s->dead = 1;
 
     if (s->bound) {
-        HASH_DEL(the_runtime->inprocs, s);
+        HASH_DEL(rt->inprocs, s);
         cleanup = s->bind_counter;
     } else {
         assert(s->links);
@@ -216,11 +219,13 @@ void Sinproc_socket_close(nitro_inproc_socket_t *s) {
         Sinproc_socket_destroy(s);
     }
 
-    pthread_mutex_unlock(&the_runtime->l_inproc);
+    pthread_mutex_unlock(&rt->l_inproc);
     nitro_counted_buffer_decref(cleanup);
 }
 
-static int Sinproc_socket_send_general(nitro_inproc_socket_t *s,  nitro_frame_t *fr, int flags) {
+/* all `n` frames go to the same peer; returns the number it took */
+static int Sinproc_socket_send_general_many(nitro_inproc_socket_t *s,
+        nitro_frame_t **frames, int n, double timeout) {
     int ret = -1;
 
     if (s->bound) {
@@ -242,10 +247,12 @@ static int Sinproc_socket_send_general(nitro_inproc_socket_t *s,  nitro_frame_t
                          &s->current, (nitro_inproc_socket_t *)try, try->next);
             }
 
-            ret = nitro_queue_push(try->q_recv, fr,
-                                       !(flags & NITRO_NOWAIT));
+            ret = nitro_queue_push_batch_timeout(try->q_recv, frames, n,
+                                                 timeout);
 
-            INCR_STAT((nitro_inproc_socket_t *)try, try->stat_recv, 1);
+            if (ret > 0) {
+                INCR_STAT((nitro_inproc_socket_t *)try, try->stat_recv, ret);
+            }
         }
 
         pthread_rwlock_unlock(&s->link_lock);
@@ -255,15 +262,22 @@ static int Sinproc_socket_send_general(nitro_inproc_socket_t *s,  nitro_frame_t
         if (s->links->dead) {
             nitro_set_error(NITRO_ERR_INPROC_NO_CONNECTIONS);
         } else {
-            ret = nitro_queue_push(s->links->q_recv, fr,
-                                   !(flags & NITRO_NOWAIT));
-            INCR_STAT(s->links, s->links->stat_recv, 1);
+            ret = nitro_queue_push_batch_timeout(s->links->q_recv, frames, n,
+                                                 timeout);
+
+            if (ret > 0) {
+                INCR_STAT(s->links, s->links->stat_recv, ret);
+            }
         }
     }
 
     return ret;
 }
 
+static int Sinproc_socket_send_general(nitro_inproc_socket_t *s,  nitro_frame_t *fr, double timeout) {
+    return Sinproc_socket_send_general_many(s, &fr, 1, timeout) == 1 ? 0 : -1;
+}
+
 static int Sinproc_socket_send_to_ident(nitro_inproc_socket_t *s, uint8_t *ident, nitro_frame_t *fr, int flags) {
     int ret = -1;
 
@@ -301,6 +315,12 @@ static int Sinproc_socket_send_to_ident(nitro_inproc_socket_t *s, uint8_t *ident
 }
 
 int Sinproc_socket_send(nitro_inproc_socket_t *s, nitro_frame_t **frp, int flags) {
+    return Sinproc_socket_send_timeout(s, frp,
+                                       (flags & NITRO_NOWAIT) ? 0 : -1, flags);
+}
+
+int Sinproc_socket_send_timeout(nitro_inproc_socket_t *s, nitro_frame_t **frp,
+                                double timeout, int flags) {
     nitro_frame_t *fr = *frp;
 
     if (flags & NITRO_REUSE) {
@@ -311,7 +331,7 @@ int Sinproc_socket_send(nitro_inproc_socket_t *s, nitro_frame_t **frp, int flags
 
     nitro_frame_set_sender(fr, s->opt->ident, s->opt->ident_buf);
 
-    int ret = Sinproc_socket_send_general(s, fr, flags);
+    int ret = Sinproc_socket_send_general(s, fr, timeout);
 
     if (ret) {
         nitro_frame_destroy(fr);
@@ -320,10 +340,56 @@ int Sinproc_socket_send(nitro_inproc_socket_t *s, nitro_frame_t **frp, int flags
     return ret;
 }
 
+int Sinproc_socket_send_many(nitro_inproc_socket_t *s, nitro_frame_t **frames,
+                             int n, int flags) {
+    nitro_frame_t **out = frames;
+    int i;
+
+    if (flags & NITRO_REUSE) {
+        out = malloc(n * sizeof(nitro_frame_t *));
+
+        for (i = 0; i < n; i++) {
+            out[i] = nitro_frame_copy_partial(frames[i], NULL);
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        nitro_frame_set_sender(out[i], s->opt->ident, s->opt->ident_buf);
+    }
+
+    int ret = Sinproc_socket_send_general_many(s, out, n,
+              (flags & NITRO_NOWAIT) ? 0 : -1);
+    int taken = ret < 0 ? 0 : ret;
+
+    if (out != frames) {
+        /* the caller keeps the originals; drop copies not taken */
+        for (i = taken; i < n; i++) {
+            nitro_frame_destroy(out[i]);
+        }
+
+        free(out);
+    } else {
+        for (i = 0; i < taken; i++) {
+            frames[i] = NULL;
+        }
+    }
+
+    return ret;
+}
+
 nitro_frame_t *Sinproc_socket_recv(nitro_inproc_socket_t *s, int flags) {
     return nitro_queue_pull(s->q_recv, !(flags & NITRO_NOWAIT));
 }
 
+nitro_frame_t *Sinproc_socket_recv_timeout(nitro_inproc_socket_t *s, double timeout) {
+    return nitro_queue_pull_timeout(s->q_recv, timeout);
+}
+
+int Sinproc_socket_recv_many(nitro_inproc_socket_t *s,
+                             nitro_frame_t **frames, int max, int flags) {
+    return nitro_queue_pull_batch(s->q_recv, frames, max, !(flags & NITRO_NOWAIT));
+}
+
 int Sinproc_socket_reply(nitro_inproc_socket_t *s, nitro_frame_t *snd, nitro_frame_t **frp, int flags) {
     int ret = -1;
     nitro_frame_t *fr = *frp;
@@ -353,7 +419,8 @@ int Sinproc_socket_relay_fw(nitro_inproc_socket_t *s, nitro_frame_t *snd, nitro_
     nitro_frame_set_sender(fr, s->opt->ident, s->opt->ident_buf);
     nitro_frame_extend_stack(snd, fr);
 
-    ret = Sinproc_socket_send_general(s, fr, flags);
+    ret = Sinproc_socket_send_general(s, fr,
+                                      (flags & NITRO_NOWAIT) ? 0 : -1);
 
     if (!(flags & NITRO_REUSE)) {
         nitro_frame_destroy(*frp);
@@ -586,18 +653,19 @@ void Sinproc_socket_describe(nitro_inproc_socket_t *s, nitro_buffer_t *buf) {
     int written;
 
     if (!s->bound) {
-        written = snprintf(ptr, amt, "C-%02x%02x%02x%02x inproc://%s (recv_q=%u, recv_tot=%" PRIu64 ")\n",
+        written = snprintf(ptr, amt, "C-%02x%02x%02x%02x inproc://%s (recv_q=%u, recv_tot=%" PRIu64 ", expired_tot=%" PRIu64 ")\n",
                            SOCKET_UNIVERSAL(s)->opt->ident[0],
                            SOCKET_UNIVERSAL(s)->opt->ident[1],
                            SOCKET_UNIVERSAL(s)->opt->ident[2],
                            SOCKET_UNIVERSAL(s)->opt->ident[3],
                            s->given_location,
                            nitro_queue_count(s->q_recv),
-                           s->stat_recv
+                           s->stat_recv,
+                           s->stat_expired
                           );
         nitro_buffer_extend(buf, written);
     } else {
-        written = snprintf(ptr, amt, "B-%02x%02x%02x%02x  inproc://%s (peers=%d, recv_q=%u, recv_tot=%" PRIu64 ")\n",
+        written = snprintf(ptr, amt, "B-%02x%02x%02x%02x  inproc://%s (peers=%d, recv_q=%u, recv_tot=%" PRIu64 ", expired_tot=%" PRIu64 ")\n",
                            SOCKET_UNIVERSAL(s)->opt->ident[0],
                            SOCKET_UNIVERSAL(s)->opt->ident[1],
                            SOCKET_UNIVERSAL(s)->opt->ident[2],
@@ -605,7 +673,8 @@ void Sinproc_socket_describe(nitro_inproc_socket_t *s, nitro_buffer_t *buf) {
                            s->given_location,
                            s->num_links,
                            nitro_queue_count(s->q_recv),
-                           s->stat_recv
+                           s->stat_recv,
+                           s->stat_expired
                           );
         nitro_buffer_extend(buf, written);
     }
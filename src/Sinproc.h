@@ -49,7 +49,14 @@ void Sinproc_socket_start_shutdown(nitro_inproc_socket_t *s);
 void Sinproc_socket_close(nitro_inproc_socket_t *s);
 
 int Sinproc_socket_send(nitro_inproc_socket_t *s, nitro_frame_t **frp, int flags);
+int Sinproc_socket_send_timeout(nitro_inproc_socket_t *s, nitro_frame_t **frp,
+                                double timeout, int flags);
+int Sinproc_socket_send_many(nitro_inproc_socket_t *s, nitro_frame_t **frames,
+                             int n, int flags);
 nitro_frame_t *Sinproc_socket_recv(nitro_inproc_socket_t *s, int flags);
+nitro_frame_t *Sinproc_socket_recv_timeout(nitro_inproc_socket_t *s, double timeout);
+int Sinproc_socket_recv_many(nitro_inproc_socket_t *s,
+                             nitro_frame_t **frames, int max, int flags);
 int Sinproc_socket_reply(nitro_inproc_socket_t *s, nitro_frame_t *snd, nitro_frame_t **frp, int flags);
 int Sinproc_socket_relay_fw(nitro_inproc_socket_t *s, nitro_frame_t *snd, nitro_frame_t **frp, int flags);
 int Sinproc_socket_relay_bk(nitro_inproc_socket_t *s, nitro_frame_t *snd, nitro_frame_t **frp, int flags);
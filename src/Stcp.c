@@ -36,6 +36,8 @@
 #include "common.h"
 
 #include "async.h"
+#include "compress.h"
+#include "crc32c.h"
 #include "crypto.h"
 #include "err.h"
 #include "runtime.h"
@@ -45,7 +47,6 @@
 
 #include <netdb.h>
 
-#define TCP_INBUF (64 * 1024)
 
 /* For Mac OS X */
 #ifndef TCP_KEEPIDLE
@@ -83,9 +84,9 @@ void Stcp_socket_close_cb(
 
 /* Various FW declaration */
 void Stcp_socket_disable_reads(nitro_tcp_socket_t *s);
-void Stcp_make_pipe(nitro_tcp_socket_t *s, int fd, struct sockaddr_in *addr);
 void Stcp_destroy_pipe(nitro_pipe_t *p);
 void Stcp_socket_start_connect(nitro_tcp_socket_t *s);
+static void Stcp_pipe_set_input(nitro_pipe_t *p, nitro_buffer_t *buf);
 
 static void Stcp_set_socket_options(int s, int alive_time) {
     int flag = 1;
@@ -201,6 +202,38 @@ static int Stcp_parse_location(char *p_location,
     return 0;
 }
 
+/*
+ * Stcp_socket_schedule_all
+ * ------------------------
+ *
+ * Schedule a socket-wide command on every loop, since the
+ * socket's pipes may be spread across all of them.
+ *
+ * If `pending` is given, loops that already have one of these
+ * commands queued (and not yet run) are skipped.
+ *
+ * Nothing is queued once the socket is closing.
+ */
+static void Stcp_socket_schedule_all(nitro_tcp_socket_t *s, int type, int *pending) {
+    int i;
+
+    pthread_mutex_lock(&s->l_schedule);
+
+    for (i = 0; !s->closing && i < s->runtime->num_loops; i++) {
+        if (pending && !__sync_bool_compare_and_swap(&pending[i], 0, 1)) {
+            __sync_fetch_and_add(&s->stat_wakes_coalesced, 1);
+            continue;
+        }
+
+        nitro_async_t a = {type};
+        /* all socket-targeted commands share this layout */
+        a.u.enable_writes.socket = SOCKET_PARENT(s);
+        nitro_async_schedule(&a, &s->runtime->loops[i]);
+    }
+
+    pthread_mutex_unlock(&s->l_schedule);
+}
+
 /*
  * Stcp_socket_send_queue_stat
  * ---------------------------
@@ -212,9 +245,8 @@ static int Stcp_parse_location(char *p_location,
 void Stcp_socket_send_queue_stat(NITRO_QUEUE_STATE st, NITRO_QUEUE_STATE last, void *p) {
     if (last == NITRO_QUEUE_STATE_EMPTY) {
         nitro_tcp_socket_t *s = (nitro_tcp_socket_t *)p;
-        nitro_async_t *a = nitro_async_new(NITRO_ASYNC_ENABLE_WRITES);
-        a->u.enable_writes.socket = SOCKET_PARENT(s);
-        nitro_async_schedule(a);
+        Stcp_socket_schedule_all(s, NITRO_ASYNC_ENABLE_WRITES,
+                                 s->write_wake_pending);
     }
 }
 
@@ -254,9 +286,8 @@ void Stcp_socket_recv_queue_stat(NITRO_QUEUE_STATE st, NITRO_QUEUE_STATE last, v
         Stcp_socket_disable_reads(s);
     } else if (last == NITRO_QUEUE_STATE_FULL) {
         /* async, we're not on nitro thread */
-        nitro_async_t *a = nitro_async_new(NITRO_ASYNC_ENABLE_READS);
-        a->u.enable_reads.socket = SOCKET_PARENT(s);
-        nitro_async_schedule(a);
+        Stcp_socket_schedule_all(s, NITRO_ASYNC_ENABLE_READS,
+                                 s->read_wake_pending);
     }
 }
 
@@ -266,13 +297,19 @@ void Stcp_queue_do_nothing_stat(
 /* Stcp_create_queues
  * ------------------
  *
- * Create the global in/out queues associated with a socket
+ * Create the global in/out queues associated with a socket,
+ * and the wakeup flags their callbacks use
  */
 void Stcp_create_queues(nitro_tcp_socket_t *s) {
-    s->q_send = nitro_queue_new(
-                    s->opt->hwm_out_general, Stcp_socket_send_queue_stat, (void *)s);
-    s->q_recv = nitro_queue_new(
-                    s->opt->hwm_in, Stcp_socket_recv_queue_stat, (void *)s);
+    s->write_wake_pending = calloc(s->runtime->num_loops, sizeof(int));
+    s->read_wake_pending = calloc(s->runtime->num_loops, sizeof(int));
+    pthread_mutex_init(&s->l_schedule, NULL);
+    s->q_send = nitro_socket_queue_new(s->opt,
+                    s->opt->hwm_out_general, s->opt->hwm_bytes_out_general, 1, &s->stat_expired,
+                    Stcp_socket_send_queue_stat, (void *)s);
+    s->q_recv = nitro_socket_queue_new(s->opt,
+                    s->opt->hwm_in, s->opt->hwm_bytes_in, 0, &s->stat_expired,
+                    Stcp_socket_recv_queue_stat, (void *)s);
     s->q_empty = nitro_queue_new(
                      0, Stcp_queue_do_nothing_stat, NULL);
 }
@@ -294,6 +331,7 @@ int Stcp_socket_connect(nitro_tcp_socket_t *s, char *location) {
     }
 
     s->outbound = 1;
+    s->loop = nitro_runtime_next_loop(s->runtime);
 
     pthread_mutex_init(&s->l_pipes, NULL);
     Stcp_create_queues(s);
@@ -310,9 +348,9 @@ int Stcp_socket_connect(nitro_tcp_socket_t *s, char *location) {
         s->opt->reconnect_interval, 0);
     s->connect_timer.data = s;
 
-    nitro_async_t *a = nitro_async_new(NITRO_ASYNC_CONNECT);
-    a->u.connect.socket = SOCKET_PARENT(s);
-    nitro_async_schedule(a);
+    nitro_async_t a = {NITRO_ASYNC_CONNECT};
+    a.u.connect.socket = SOCKET_PARENT(s);
+    nitro_async_schedule(&a, s->loop);
 
     return 0;
 }
@@ -330,6 +368,7 @@ int Stcp_socket_bind(nitro_tcp_socket_t *s, char *location) {
         return r;
     }
 
+    s->loop = nitro_runtime_next_loop(s->runtime);
     pthread_mutex_init(&s->l_pipes, NULL);
     Stcp_create_queues(s);
     ev_timer_init(
@@ -364,9 +403,9 @@ int Stcp_socket_bind(nitro_tcp_socket_t *s, char *location) {
     s->bound_io.data = s;
 
     /* we need to do the ev work on the ev thread */
-    nitro_async_t *bg = nitro_async_new(NITRO_ASYNC_BIND_LISTEN);
-    bg->u.bind_listen.socket = (nitro_socket_t *)s->parent;
-    nitro_async_schedule(bg);
+    nitro_async_t bg = {NITRO_ASYNC_BIND_LISTEN};
+    bg.u.bind_listen.socket = (nitro_socket_t *)s->parent;
+    nitro_async_schedule(&bg, s->loop);
 
     return 0;
 }
@@ -385,31 +424,89 @@ void Stcp_socket_start_shutdown(nitro_tcp_socket_t *s) {
         Stcp_socket_close_cb,
         s->opt->close_linger, 0);
     s->close_timer.data = s;
-    ev_timer_start(the_runtime->the_loop, &s->close_timer);
+    ev_timer_start(s->loop->the_loop, &s->close_timer);
 }
 
 /*
- * Stcp_socket_shutdown
- * --------------------
- *
- * Close all pipes and destroy the socket.
+ * Stcp_socket_destroy_loop_pipes
+ * ------------------------------
  *
- * Typically called as a result of close_timer firing after the
- * "linger" period has elapsed.
+ * Destroy every pipe owned by loop `l`.  Other loops may be
+ * adding or removing their own pipes concurrently, so each
+ * one is found under the lock.
  */
-void Stcp_socket_shutdown(nitro_tcp_socket_t *s) {
-    nitro_pipe_t *tmp1, *tmp2, *p = NULL;
+static void Stcp_socket_destroy_loop_pipes(nitro_tcp_socket_t *s, nitro_loop_t *l) {
+    NITRO_THREAD_CHECK(l);
+    nitro_pipe_t *p;
 
-    CDL_FOREACH_SAFE(s->pipes, p, tmp1, tmp2) {
-        Stcp_destroy_pipe(p);
+    while (1) {
+        nitro_pipe_t *found = NULL;
+        pthread_mutex_lock(&s->l_pipes);
+        CDL_FOREACH(s->pipes, p) {
+            if (p->loop == l) {
+                found = p;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&s->l_pipes);
+
+        if (!found) {
+            break;
+        }
+
+        Stcp_destroy_pipe(found);
     }
+}
 
+/*
+ * Stcp_socket_finish_shutdown
+ * ---------------------------
+ *
+ * Release the socket once every loop has closed its pipes.
+ */
+static void Stcp_socket_finish_shutdown(nitro_tcp_socket_t *s) {
     nitro_queue_destroy(s->q_send);
     nitro_queue_destroy(s->q_recv);
     nitro_queue_destroy(s->q_empty);
-    ev_timer_stop(the_runtime->the_loop, &s->connect_timer);
-    ev_io_stop(the_runtime->the_loop, &s->connect_io);
-    ev_io_stop(the_runtime->the_loop, &s->bound_io);
+    free(s->write_wake_pending);
+    free(s->read_wake_pending);
+    pthread_mutex_destroy(&s->l_schedule);
+
+    nitro_socket_destroy(SOCKET_PARENT(s));
+}
+
+/*
+ * Stcp_socket_close_loop_pipes
+ * ----------------------------
+ *
+ * Close all of the socket's pipes owned by loop `l`.  The last
+ * loop to finish destroys the socket.
+ */
+void Stcp_socket_close_loop_pipes(nitro_tcp_socket_t *s, nitro_loop_t *l) {
+    Stcp_socket_destroy_loop_pipes(s, l);
+
+    if (__sync_sub_and_fetch(&s->closing_loops, 1) == 0) {
+        Stcp_socket_finish_shutdown(s);
+    }
+}
+
+/*
+ * Stcp_socket_shutdown
+ * --------------------
+ *
+ * Close all pipes and destroy the socket.
+ *
+ * Typically called as a result of close_timer firing after the
+ * "linger" period has elapsed.  Every loop, this one included,
+ * closes its pipes from a queued CLOSE_PIPES, so commands for
+ * the socket queued before it have all run by the time the
+ * last loop frees the socket.
+ */
+void Stcp_socket_shutdown(nitro_tcp_socket_t *s) {
+    ev_timer_stop(s->loop->the_loop, &s->connect_timer);
+    ev_timer_stop(s->loop->the_loop, &s->sub_send_timer);
+    ev_io_stop(s->loop->the_loop, &s->connect_io);
+    ev_io_stop(s->loop->the_loop, &s->bound_io);
 
     if (s->bound_fd > 0) {
         close(s->bound_fd);
@@ -419,7 +516,18 @@ void Stcp_socket_shutdown(nitro_tcp_socket_t *s) {
         close(s->connect_fd);
     }
 
-    nitro_socket_destroy(SOCKET_PARENT(s));
+    pthread_mutex_lock(&s->l_schedule);
+    s->closing = 1;
+    pthread_mutex_unlock(&s->l_schedule);
+
+    s->closing_loops = s->runtime->num_loops;
+    int i;
+
+    for (i = 0; i < s->runtime->num_loops; i++) {
+        nitro_async_t a = {NITRO_ASYNC_CLOSE_PIPES};
+        a.u.close_pipes.socket = SOCKET_PARENT(s);
+        nitro_async_schedule(&a, &s->runtime->loops[i]);
+    }
 }
 
 /*
@@ -445,8 +553,8 @@ void Stcp_socket_close_cb(
  * for accept(), which will create a new pipe
  */
 void Stcp_socket_bind_listen(nitro_tcp_socket_t *s) {
-    NITRO_THREAD_CHECK;
-    ev_io_start(the_runtime->the_loop,
+    NITRO_THREAD_CHECK(s->loop);
+    ev_io_start(s->loop->the_loop,
                 &s->bound_io);
 }
 
@@ -529,7 +637,7 @@ void Stcp_socket_connect_timer_cb(
     ev_timer *connect_timer,
     int revents) {
     nitro_tcp_socket_t *s = (nitro_tcp_socket_t *)connect_timer->data;
-    ev_timer_stop(the_runtime->the_loop, connect_timer);
+    ev_timer_stop(s->loop->the_loop, connect_timer);
 
     Stcp_socket_start_connect(s);
 }
@@ -555,19 +663,19 @@ void Stcp_connect_cb(
                     sizeof(s->location));
 
     if (!t || errno == EISCONN || !errno) {
-        ev_io_stop(the_runtime->the_loop, &s->connect_io);
+        ev_io_stop(s->loop->the_loop, &s->connect_io);
         Stcp_make_pipe(s, s->connect_fd, NULL);
         s->connect_fd = -1;
     } else if (errno == EINPROGRESS || errno == EINTR || errno == EALREADY) {
         /* do nothing, we'll get phoned home again... */
     } else {
         /* let's restart the timer */
-        ev_io_stop(the_runtime->the_loop, &s->connect_io);
+        ev_io_stop(s->loop->the_loop, &s->connect_io);
         close(s->connect_fd);
         ev_timer_set(
             &s->connect_timer,
             s->opt->reconnect_interval, 0);
-        ev_timer_start(the_runtime->the_loop, &s->connect_timer);
+        ev_timer_start(s->loop->the_loop, &s->connect_timer);
     }
 }
 
@@ -580,7 +688,7 @@ void Stcp_connect_cb(
  * when the nitro socket is in the disconnected state.
  */
 void Stcp_socket_start_connect(nitro_tcp_socket_t *s) {
-    NITRO_THREAD_CHECK;
+    NITRO_THREAD_CHECK(s->loop);
 
     s->connect_fd = Stcp_nonblocking_socket_new(s->opt->tcp_keep_alive);
 
@@ -604,13 +712,13 @@ void Stcp_socket_start_connect(nitro_tcp_socket_t *s) {
                     sizeof(s->location));
 
     if (t == 0 || errno == EINPROGRESS || errno == EINTR) {
-        ev_io_start(the_runtime->the_loop, &s->connect_io);
+        ev_io_start(s->loop->the_loop, &s->connect_io);
     } else {
         close(s->connect_fd);
         ev_timer_set(
             &s->connect_timer,
             s->opt->reconnect_interval, 0);
-        ev_timer_start(the_runtime->the_loop, &s->connect_timer);
+        ev_timer_start(s->loop->the_loop, &s->connect_timer);
     }
 }
 
@@ -622,14 +730,21 @@ void Stcp_socket_start_connect(nitro_tcp_socket_t *s) {
  * with a particular pipe.
  *
  * A move from EMPTY to any non-empty state should trigger the pipe to make
- * sure writing is enabled (and re-enable it if necessary).
+ * sure writing is enabled (and re-enable it if necessary).  Only one
+ * such wakeup is queued at a time.
  */
 void Stcp_pipe_send_queue_stat(NITRO_QUEUE_STATE st, NITRO_QUEUE_STATE last, void *baton) {
     if (last == NITRO_QUEUE_STATE_EMPTY) {
         nitro_pipe_t *p = (nitro_pipe_t *)baton;
-        nitro_async_t *a = nitro_async_new(NITRO_ASYNC_ENABLE_WRITES);
-        a->u.enable_writes.pipe = p;
-        nitro_async_schedule(a);
+
+        if (!__sync_bool_compare_and_swap(&p->write_wake_pending, 0, 1)) {
+            __sync_fetch_and_add(&p->stat_wakes_coalesced, 1);
+            return;
+        }
+
+        nitro_async_t a = {NITRO_ASYNC_ENABLE_WRITES};
+        a.u.enable_writes.pipe = p;
+        nitro_async_schedule(&a, p->loop);
     }
 }
 
@@ -641,9 +756,10 @@ void Stcp_pipe_send_queue_stat(NITRO_QUEUE_STATE st, NITRO_QUEUE_STATE last, voi
  */
 void Stcp_destroy_pipe(nitro_pipe_t *p) {
     nitro_tcp_socket_t *s = (nitro_tcp_socket_t *)p->the_socket;
-    ev_io_stop(the_runtime->the_loop, &p->iow);
-    ev_io_stop(the_runtime->the_loop, &p->ior);
-    nitro_buffer_destroy(p->in_buffer);
+    NITRO_THREAD_CHECK(p->loop);
+    ev_io_stop(p->loop->the_loop, &p->iow);
+    ev_io_stop(p->loop->the_loop, &p->ior);
+    nitro_counted_buffer_decref(p->in.cbuf);
     nitro_queue_destroy(p->q_send);
     close(p->fd);
 
@@ -651,10 +767,15 @@ void Stcp_destroy_pipe(nitro_pipe_t *p) {
         nitro_frame_destroy(p->partial);
     }
 
+    while (p->batch_next < p->batch_count) {
+        nitro_frame_destroy(p->batch[p->batch_next++]);
+    }
+
     Stcp_pipe_destroy(p, s);
 
-    if (s->outbound) {
-        ev_timer_start(the_runtime->the_loop, &s->connect_timer);
+    if (s->outbound && !s->closing) {
+        /* connect sockets keep their pipe on the socket's loop */
+        ev_timer_start(s->loop->the_loop, &s->connect_timer);
     }
 }
 
@@ -666,13 +787,17 @@ void Stcp_destroy_pipe(nitro_pipe_t *p) {
  * This fd could ahve been created via an accept (on
  * bound nitro sockets) or via a connect() (on connected
  * nitro sockets).
+ *
+ * The pipe is owned by the loop this is called on.
  */
 void Stcp_make_pipe(nitro_tcp_socket_t *s, int fd, struct sockaddr_in *addr) {
-    NITRO_THREAD_CHECK;
+    nitro_loop_t *l = nitro_runtime_current_loop();
+    assert(l);
     nitro_pipe_t *p = Stcp_pipe_new(s);
     p->fd = fd;
-    p->in_buffer = nitro_buffer_new();
+    p->loop = l;
     p->the_socket = s;
+    Stcp_pipe_set_input(p, nitro_buffer_new_segment());
 
     ev_io_init(&p->iow, Stcp_pipe_out_cb,
                p->fd, EV_WRITE);
@@ -682,13 +807,13 @@ void Stcp_make_pipe(nitro_tcp_socket_t *s, int fd, struct sockaddr_in *addr) {
                p->fd, EV_READ);
     p->ior.data = p;
 
-    p->q_send = nitro_queue_new(
-                    s->opt->hwm_out_private,
+    p->q_send = nitro_socket_queue_new(s->opt,
+                    s->opt->hwm_out_private, s->opt->hwm_bytes_out_private, 1, &s->stat_expired,
                     Stcp_pipe_send_queue_stat, p);
 
-    ev_io_start(the_runtime->the_loop,
+    ev_io_start(l->the_loop,
                 &p->iow);
-    ev_io_start(the_runtime->the_loop,
+    ev_io_start(l->the_loop,
                 &p->ior);
 
     p->born = now_double();
@@ -710,40 +835,110 @@ void Stcp_make_pipe(nitro_tcp_socket_t *s, int fd, struct sockaddr_in *addr) {
  * Enable the libev write callback on a particular pipe.
  */
 void Stcp_pipe_enable_write(nitro_pipe_t *p) {
-    NITRO_THREAD_CHECK;
-    ev_io_start(the_runtime->the_loop,
+    NITRO_THREAD_CHECK(p->loop);
+    /* clear first, so a later EMPTY->CONTENTS queues a new wakeup */
+    __sync_lock_release(&p->write_wake_pending);
+    ev_io_start(p->loop->the_loop,
                 &p->iow);
 }
 
+/*
+ * Stcp_socket_recv_full
+ * ---------------------
+ *
+ * Is the socket's recv queue at its high water mark?
+ */
+static int Stcp_socket_recv_full(nitro_tcp_socket_t *s) {
+    return nitro_queue_full(s->q_recv);
+}
+
 /*
  * Stcp_socket_enable_writes
  * -------------------------
  *
- * Enable the libev write callbacks on all connected pipes.
+ * Enable the libev write callbacks on all connected pipes
+ * owned by the calling loop.
  */
 void Stcp_socket_enable_writes(nitro_tcp_socket_t *s) {
-    NITRO_THREAD_CHECK;
+    nitro_loop_t *l = nitro_runtime_current_loop();
+    assert(l);
     nitro_pipe_t *p;
+    __sync_lock_release(&s->write_wake_pending[l->index]);
 
+    pthread_mutex_lock(&s->l_pipes);
     CDL_FOREACH(s->pipes, p) {
-        ev_io_start(the_runtime->the_loop,
-                    &p->iow);
+        if (p->loop == l) {
+            ev_io_start(l->the_loop,
+                        &p->iow);
+        }
     }
+    pthread_mutex_unlock(&s->l_pipes);
 }
 
 /*
  * Stcp_socket_enable_reads
  * ------------------------
  *
- * Enable reads on all connected pipes.
+ * Enable reads on all connected pipes owned by the calling loop,
+ * unless the recv queue has filled up again since this was queued.
  */
 void Stcp_socket_enable_reads(nitro_tcp_socket_t *s) {
-    NITRO_THREAD_CHECK;
+    nitro_loop_t *l = nitro_runtime_current_loop();
+    assert(l);
+    nitro_pipe_t *p;
+    __sync_lock_release(&s->read_wake_pending[l->index]);
+
+    if (Stcp_socket_recv_full(s)) {
+        return;
+    }
+
+    pthread_mutex_lock(&s->l_pipes);
+    CDL_FOREACH(s->pipes, p) {
+        if (p->loop == l) {
+            ev_io_start(l->the_loop,
+                        &p->ior);
+
+            /* input held back while the queue was full may be
+               all there is; parse it without waiting on the fd */
+            if (p->in.start < p->in.buf->size) {
+                ev_feed_event(l->the_loop, &p->ior, EV_READ);
+            }
+        }
+    }
+    pthread_mutex_unlock(&s->l_pipes);
+}
+
+/*
+ * Stcp_socket_stop_loop_reads
+ * ---------------------------
+ *
+ * Disable reads on all connected pipes owned by loop `l`.
+ */
+static void Stcp_socket_stop_loop_reads(nitro_tcp_socket_t *s, nitro_loop_t *l) {
+    NITRO_THREAD_CHECK(l);
     nitro_pipe_t *p;
 
+    pthread_mutex_lock(&s->l_pipes);
     CDL_FOREACH(s->pipes, p) {
-        ev_io_start(the_runtime->the_loop,
-                    &p->ior);
+        if (p->loop == l) {
+            ev_io_stop(l->the_loop,
+                       &p->ior);
+        }
+    }
+    pthread_mutex_unlock(&s->l_pipes);
+}
+
+/*
+ * Stcp_socket_disable_loop_reads
+ * ------------------------------
+ *
+ * Queued version of Stcp_socket_stop_loop_reads.  Enable and
+ * disable commands may run out of order relative to the recv
+ * queue's state changes, so only stop if it's still full.
+ */
+void Stcp_socket_disable_loop_reads(nitro_tcp_socket_t *s, nitro_loop_t *l) {
+    if (Stcp_socket_recv_full(s)) {
+        Stcp_socket_stop_loop_reads(s, l);
     }
 }
 
@@ -751,17 +946,35 @@ void Stcp_socket_enable_reads(nitro_tcp_socket_t *s) {
  * Stcp_socket_disable_reads
  * -------------------------
  *
- * Disable reads on all connected pipes.
+ * Disable reads on all connected pipes.  Pipes on the
+ * calling loop stop right away; other loops are told to.
  *
  * (Done when recv queue is full).
  */
 void Stcp_socket_disable_reads(nitro_tcp_socket_t *s) {
-    NITRO_THREAD_CHECK;
-    nitro_pipe_t *p;
+    nitro_loop_t *cur = nitro_runtime_current_loop();
+    nitro_loop_t *here = NULL;
+    int i;
 
-    CDL_FOREACH(s->pipes, p) {
-        ev_io_stop(the_runtime->the_loop,
-                   &p->ior);
+    pthread_mutex_lock(&s->l_schedule);
+
+    for (i = 0; i < s->runtime->num_loops; i++) {
+        nitro_loop_t *l = &s->runtime->loops[i];
+
+        if (l == cur) {
+            here = l;
+        } else if (!s->closing) {
+            nitro_async_t a = {NITRO_ASYNC_DISABLE_READS};
+            a.u.disable_reads.socket = SOCKET_PARENT(s);
+            nitro_async_schedule(&a, l);
+        }
+    }
+
+    pthread_mutex_unlock(&s->l_schedule);
+
+    /* outside l_schedule, which is taken with l_pipes held */
+    if (here) {
+        Stcp_socket_stop_loop_reads(s, here);
     }
 }
 
@@ -774,9 +987,9 @@ void Stcp_socket_disable_reads(nitro_tcp_socket_t *s) {
  * (PUBLIC API)
  */
 void Stcp_socket_close(nitro_tcp_socket_t *s) {
-    nitro_async_t *a = nitro_async_new(NITRO_ASYNC_CLOSE);
-    a->u.close.socket = SOCKET_PARENT(s);
-    nitro_async_schedule(a);
+    nitro_async_t a = {NITRO_ASYNC_CLOSE};
+    a.u.close.socket = SOCKET_PARENT(s);
+    nitro_async_schedule(&a, s->loop);
 }
 
 /* state used during frame parse callbacks */
@@ -902,6 +1115,150 @@ static void Stcp_socket_parse_subs(nitro_tcp_socket_t *s, nitro_pipe_t *p,
     p->sub_state_recv = state;
 }
 
+/*
+ * Stcp_data_frame
+ * ---------------
+ *
+ * Make the frame for one received DATA frame (on its own or
+ * in a BATCH).  Tiny frames are copied inline rather than pin
+ * the whole receive buffer, as are (into a buffer of their
+ * own, along with their ident stack) any smaller than the
+ * socket's copy_below, and compressed ones are inflated
+ * into their own; others share it, retained through *bbuf_p
+ * (as are ident stacks).  Returns NULL if a compressed
+ * payload is corrupt.
+ */
+static nitro_frame_t *Stcp_data_frame(tcp_frame_parse_state *st,
+                                      const uint8_t *frame_data, uint32_t size,
+                                      uint8_t num_ident, uint8_t flags,
+                                      nitro_counted_buffer_t **bbuf_p) {
+    nitro_frame_t *fr;
+    int compressed = flags & NITRO_FRAME_COMPRESSED;
+    int copied = size < st->s->opt->copy_below;
+    int shared = !compressed && !copied && size > NITRO_FRAME_INLINE;
+    int own_stack = copied && num_ident;
+    /* does it keep the receive buffer itself alive? */
+    int pins = (shared || (num_ident && !own_stack)) &&
+               *bbuf_p == st->cbuf;
+
+    if ((shared || num_ident) && !*bbuf_p) {
+        /* it is official, we will consume data... */
+
+        /* first incref is for the socket itself, not done copying yet */
+        *bbuf_p = nitro_counted_buffer_new(
+                      NULL, buffer_free, (void *)st->buf);
+    }
+
+    if (compressed) {
+        uint32_t clear_size;
+        uint8_t *clear = compress_inflate(frame_data, size,
+                                          st->s->opt->max_message_size, &clear_size);
+
+        if (!clear) {
+            return NULL;
+        }
+
+        fr = nitro_frame_new_heap(clear, clear_size);
+    } else if (shared) {
+        /* Incref for the eventual recipient */
+        nitro_counted_buffer_incref(*bbuf_p);
+        fr = nitro_frame_new_prealloc((char *)frame_data, size, *bbuf_p);
+
+        if (pins) {
+            fr->recv_shared = 1;
+            __sync_fetch_and_add(&nitro_buffer_stat_referenced, size);
+        }
+    } else {
+        fr = nitro_frame_new_copy((char *)frame_data, size);
+    }
+
+    if (pins) {
+        nitro_buffer_pin(st->buf);
+    }
+
+    INCR_STAT(st->s, st->s->stat_recv, 1);
+    INCR_STAT(st->s, st->p->stat_recv, 1);
+
+    /* If this has a ident stack that's been routed, copy/retain it */
+    if (own_stack) {
+        size_t stack_size = num_ident * SOCKET_IDENT_LENGTH;
+        uint8_t *stack = malloc(stack_size);
+        memcpy(stack, frame_data + size, stack_size);
+        nitro_counted_buffer_t *stack_buf = nitro_counted_buffer_new(
+                                                stack, just_free, NULL);
+        nitro_frame_set_stack(fr, stack, stack_buf, num_ident);
+        nitro_counted_buffer_decref(stack_buf);
+    } else if (num_ident) {
+        nitro_frame_set_stack(fr, frame_data + size, *bbuf_p, num_ident);
+    }
+
+    nitro_frame_set_sender(fr,
+                           st->p->remote_ident, st->p->remote_ident_buf);
+    fr->priority = flags & NITRO_FRAME_PRIORITY_MASK;
+
+    return fr;
+}
+
+/*
+ * Stcp_parse_batch
+ * ----------------
+ *
+ * Unpack a BATCH packet into st->p->batch, checking first
+ * that every frame fits inside it.  Returns 0, or -1 on a
+ * protocol error.
+ */
+static int Stcp_parse_batch(tcp_frame_parse_state *st,
+                            const uint8_t *data, uint32_t size,
+                            nitro_counted_buffer_t **bbuf_p) {
+    nitro_pipe_t *p = st->p;
+    const uint8_t *end = data + size;
+    const uint8_t *cursor;
+    nitro_batch_header bh;
+    int n = 0;
+
+    for (cursor = data; cursor < end; ++n) {
+        if (n == NITRO_FRAME_BATCH_MAX || end - cursor < sizeof(bh)) {
+            return nitro_set_error(NITRO_ERR_BAD_BATCH);
+        }
+
+        memcpy(&bh, cursor, sizeof(bh));
+        cursor += sizeof(bh);
+
+        if (end - cursor < bh.frame_size + bh.num_ident * SOCKET_IDENT_LENGTH) {
+            return nitro_set_error(NITRO_ERR_BAD_BATCH);
+        }
+
+        cursor += bh.frame_size + bh.num_ident * SOCKET_IDENT_LENGTH;
+    }
+
+    if (!n) {
+        return nitro_set_error(NITRO_ERR_BAD_BATCH);
+    }
+
+    p->batch_count = n;
+    p->batch_next = 0;
+
+    for (n = 0, cursor = data; n < p->batch_count; n++) {
+        memcpy(&bh, cursor, sizeof(bh));
+        cursor += sizeof(bh);
+        p->batch[n] = Stcp_data_frame(st, cursor, bh.frame_size,
+                                      bh.num_ident, bh.flags, bbuf_p);
+
+        if (!p->batch[n]) {
+            while (n--) {
+                nitro_frame_destroy(p->batch[n]);
+            }
+
+            p->batch_count = 0;
+            return -1;
+        }
+
+        cursor += bh.frame_size + bh.num_ident * SOCKET_IDENT_LENGTH;
+    }
+
+    return 0;
+}
+
 /*
  * Stcp_parse_next_frame
  * ---------------------
@@ -922,6 +1279,12 @@ static nitro_frame_t *Stcp_parse_next_frame(void *baton) {
     tcp_frame_parse_state *st = (tcp_frame_parse_state *)baton;
     nitro_frame_t *fr = NULL;
 
+    /* the rest of a BATCH comes first */
+    if (st->p->batch_next < st->p->batch_count) {
+        st->got_data_frames = 1;
+        return st->p->batch[st->p->batch_next++];
+    }
+
     int size;
     nitro_buffer_t const *buf = st->buf;
     char const *start = nitro_buffer_data((nitro_buffer_t *)buf, &size);
@@ -975,11 +1338,27 @@ static nitro_frame_t *Stcp_parse_next_frame(void *baton) {
         }
 
         size_t ident_size = hd->num_ident * SOCKET_IDENT_LENGTH;
+        size_t checksum_size = (hd->flags & NITRO_FRAME_CHECKSUM) ?
+                               sizeof(uint32_t) : 0;
 
-        if (left < hd->frame_size + ident_size) {
+        if (left < hd->frame_size + ident_size + checksum_size) {
             break;
         }
 
+        if (checksum_size) {
+            /* Nothing in the packet is trusted until it sums */
+            size_t covered = sizeof(nitro_protocol_header) +
+                             hd->frame_size + ident_size;
+            uint32_t sent;
+            memcpy(&sent, cursor + covered, sizeof(sent));
+
+            if (crc32c(0, cursor, covered) != sent) {
+                nitro_set_error(NITRO_ERR_BAD_CHECKSUM);
+                st->pipe_error = 1;
+                return NULL;
+            }
+        }
+
         /* "Parsing" protocol header */
         const nitro_protocol_header *phd = hd;
         const uint8_t *frame_data = (uint8_t *)cursor + sizeof(nitro_protocol_header);
@@ -1013,7 +1392,21 @@ static nitro_frame_t *Stcp_parse_next_frame(void *baton) {
             return NULL;
         }
 
-        if (phd->packet_type != NITRO_FRAME_DATA) {
+        if (phd->packet_type == NITRO_FRAME_BATCH) {
+            /* Many small data frames behind one header */
+            if (!st->p->them_handshake) {
+                nitro_set_error(NITRO_ERR_NO_HANDSHAKE);
+                st->pipe_error = 1;
+                return NULL;
+            }
+
+            if (Stcp_parse_batch(st, frame_data, phd->frame_size, bbuf_p)) {
+                st->pipe_error = 1;
+                return NULL;
+            }
+
+            fr = st->p->batch[st->p->batch_next++];
+        } else if (phd->packet_type != NITRO_FRAME_DATA) {
             /* It's a control frame; handle appropriately */
             if (phd->packet_type == NITRO_FRAME_HELLO) {
                 if (st->p->them_handshake) {
@@ -1110,33 +1503,12 @@ static nitro_frame_t *Stcp_parse_next_frame(void *baton) {
                 return NULL;
             }
 
-            INCR_STAT(st->s, st->s->stat_recv, 1);
-            INCR_STAT(st->s, st->p->stat_recv, 1);
-
-            if (!*bbuf_p) {
-                /* it is official, we will consume data... */
-
-                /* first incref is for the socket itself, not done copying yet */
-                *bbuf_p = nitro_counted_buffer_new(
-                              NULL, buffer_free, (void *)buf);
-            }
-
-            nitro_counted_buffer_t const *cbuf = *bbuf_p;
-
-            /* Incref for the eventual recipient */
-            nitro_counted_buffer_incref((nitro_counted_buffer_t *)cbuf);
-
-            fr = nitro_frame_new_prealloc(
-                     (char *)frame_data,
-                     phd->frame_size, (nitro_counted_buffer_t *)cbuf);
-            nitro_frame_set_sender(fr,
-                                   st->p->remote_ident, st->p->remote_ident_buf);
+            fr = Stcp_data_frame(st, frame_data, phd->frame_size,
+                                 phd->num_ident, phd->flags, bbuf_p);
 
-            /* If this has a ident stack that's been routed, copy/retain it */
-            if (phd->num_ident) {
-                nitro_frame_set_stack(fr,
-                                      frame_data + phd->frame_size,
-                                      (nitro_counted_buffer_t *)cbuf, phd->num_ident);
+            if (!fr) {
+                st->pipe_error = 1;
+                return NULL;
             }
         }
 
@@ -1145,7 +1517,8 @@ static nitro_frame_t *Stcp_parse_next_frame(void *baton) {
         }
 
         /* Increment cursor using original frame information */
-        st->cursor += (sizeof(nitro_protocol_header) + hd->frame_size + ident_size);
+        st->cursor += (sizeof(nitro_protocol_header) + hd->frame_size +
+                       ident_size + checksum_size);
     }
 
     if (fr) {
@@ -1155,6 +1528,76 @@ static nitro_frame_t *Stcp_parse_next_frame(void *baton) {
     return fr;
 }
 
+/*
+ * Stcp_pipe_set_input
+ * -------------------
+ *
+ * Make `buf` the buffer the pipe reads into and parses.
+ */
+static void Stcp_pipe_set_input(nitro_pipe_t *p, nitro_buffer_t *buf) {
+    p->in.buf = buf;
+    /* this reference is the pipe's; frames take their own */
+    p->in.cbuf = nitro_counted_buffer_new(NULL, buffer_free, buf);
+    p->in.start = 0;
+}
+
+/*
+ * Stcp_pipe_partial_size
+ * ----------------------
+ *
+ * The wire size of the frame at the parse position, once
+ * its header has arrived; otherwise (or if it is too big,
+ * which parsing will refuse) 0.
+ */
+static size_t Stcp_pipe_partial_size(nitro_pipe_t *p) {
+    nitro_tcp_socket_t *s = (nitro_tcp_socket_t *)p->the_socket;
+    nitro_pipe_input_t *in = &p->in;
+    nitro_protocol_header hd;
+
+    if (in->buf->size - in->start < sizeof(hd)) {
+        return 0;
+    }
+
+    memcpy(&hd, in->buf->area + in->start, sizeof(hd));
+
+    if (hd.frame_size > s->opt->max_message_size) {
+        return 0;
+    }
+
+    return sizeof(hd) + (size_t)hd.frame_size +
+           hd.num_ident * SOCKET_IDENT_LENGTH +
+           ((hd.flags & NITRO_FRAME_CHECKSUM) ? sizeof(uint32_t) : 0);
+}
+
+/*
+ * Stcp_pipe_next_input
+ * --------------------
+ *
+ * The input buffer can't usefully take any more; start a
+ * new one, carrying over the head of the frame cut off at
+ * the end (if any).
+ *
+ * That is a receive segment, unless the frame is known to
+ * be bigger than one.  Then it gets a buffer of exactly its
+ * size, the rest of it is read straight in, and the frame
+ * keeps the buffer -- it is never grown or copied again.
+ */
+static void Stcp_pipe_next_input(nitro_pipe_t *p) {
+    nitro_pipe_input_t *in = &p->in;
+    size_t left = in->buf->size - in->start;
+    size_t partial = Stcp_pipe_partial_size(p);
+    nitro_buffer_t *next = partial > NITRO_BUFFER_SEGMENT ?
+                           nitro_buffer_new_exact(partial) :
+                           nitro_buffer_new_segment();
+
+    assert(left <= next->alloc);
+    memcpy(next->area, in->buf->area + in->start, left);
+    next->size = left;
+
+    nitro_counted_buffer_decref(in->cbuf);
+    Stcp_pipe_set_input(p, next);
+}
+
 /*
  * Stcp_parse_socket_buffer
  * ------------------------
@@ -1162,19 +1605,18 @@ static nitro_frame_t *Stcp_parse_next_frame(void *baton) {
  * After having received a chunk of data from the network, attempt to
  * split it up into frames.
  *
- * If this function finds any whole frames it will retain the buffer as
- * a zero-copy refcounted backing buffer for the frame data, and it creates
- * an new empty buffer for the next recv from the network.
- *
- * If it does not find any whole frames, it keeps the network buffer for appending
- * more data.
+ * Frames keep a zero-copy reference to the input buffer, and
+ * reading carries on into whatever room is left behind them
+ * (see Stcp_pipe_next_input).
  */
 void Stcp_parse_socket_buffer(nitro_pipe_t *p) {
     /* now we parse */
     nitro_tcp_socket_t *s = (nitro_tcp_socket_t *)p->the_socket;
-
+    nitro_pipe_input_t *in = &p->in;
     tcp_frame_parse_state parse_state = {0};
-    parse_state.buf = p->in_buffer;
+    parse_state.buf = in->buf;
+    parse_state.cbuf = in->cbuf;
+    parse_state.cursor = in->buf->area + in->start;
     parse_state.p = p;
     parse_state.s = s;
 
@@ -1188,53 +1630,33 @@ void Stcp_parse_socket_buffer(nitro_pipe_t *p) {
             s->opt->error_handler(nitro_error(),
                                   s->opt->error_handler_baton);
         }
-        if (parse_state.cbuf) {
-            nitro_counted_buffer_decref(parse_state.cbuf);
-        }
+
         Stcp_destroy_pipe(p);
         return;
     }
 
-    int size;
-    char *start = nitro_buffer_data(p->in_buffer, &size);
+    in->start = parse_state.cursor - in->buf->area;
 
-    if (parse_state.cursor != start) {
-        /* If this buffer contained at least one whole frame,
-        we're going to disown it and create another one
-        with whatever fractional data remain (if any) */
+    if (in->start == in->buf->size && in->buf->segment &&
+            in->cbuf->count == 1) {
+        /* All parsed, and no frame kept a reference (they
+           were all copied, or are gone); reuse it from the top */
+        nitro_buffer_unpin(in->buf);
+        in->buf->size = in->start = 0;
+    }
 
-        /* If we got some data frames, and we're using an eventfd
-           for embedding, make sure it gets triggered as readable */
-        if (parse_state.got_data_frames && s->opt->want_eventfd) {
+    /* If we got some data frames, and we're using an eventfd
+       for embedding, make sure it gets triggered as readable */
+    if (parse_state.got_data_frames && s->opt->want_eventfd) {
 #ifdef __linux__
-            uint64_t inc = 1;
-            int evwrote = write(s->event_fd, (char *)(&inc), sizeof(inc));
-            assert(evwrote == sizeof(inc));
+        uint64_t inc = 1;
+        int evwrote = write(s->event_fd, (char *)(&inc), sizeof(inc));
+        assert(evwrote == sizeof(inc));
 #else
-            char w = 1;
-            int evwrote = write(s->event_fd, (char *)(&w), 1);
-            (void) evwrote;
+        char w = 1;
+        int evwrote = write(s->event_fd, (char *)(&w), 1);
+        (void) evwrote;
 #endif
-        }
-
-        int to_copy = size - (parse_state.cursor - start);
-        nitro_buffer_t *tmp = p->in_buffer;
-        p->in_buffer = nitro_buffer_new();
-
-        if (to_copy) {
-            int writable = TCP_INBUF > to_copy ? TCP_INBUF : to_copy;
-            char *write = nitro_buffer_prepare(p->in_buffer, &writable);
-
-            memcpy(write, parse_state.cursor, to_copy);
-            nitro_buffer_extend(p->in_buffer, to_copy);
-        }
-
-        /* Release our copy of the backing buffer */
-        if (parse_state.cbuf) {
-            nitro_counted_buffer_decref(parse_state.cbuf);
-        } else {
-            nitro_buffer_destroy(tmp);
-        }
     }
 }
 
@@ -1243,14 +1665,15 @@ void Stcp_parse_socket_buffer(nitro_pipe_t *p) {
  * ------------------
  *
  * Bound fd is readable on a bound nitro socket.  Time to
- * accept() a fd and set up a new pipe.
+ * accept() a fd and set up a new pipe.  Pipes are spread
+ * across the runtime's loops.
  */
 void Stcp_bind_callback(
     struct ev_loop *loop,
     ev_io *bind_io,
     int revents) {
-    NITRO_THREAD_CHECK;
     nitro_tcp_socket_t *s = (nitro_tcp_socket_t *)bind_io->data;
+    NITRO_THREAD_CHECK(s->loop);
 
     struct sockaddr addr;
     socklen_t len = sizeof(struct sockaddr);
@@ -1290,7 +1713,17 @@ void Stcp_bind_callback(
     Stcp_set_socket_options(fd, s->opt->tcp_keep_alive);
 
     assert(addr.sa_family == AF_INET);
-    Stcp_make_pipe(s, fd, (struct sockaddr_in *)&addr);
+    nitro_loop_t *l = nitro_runtime_next_loop(s->runtime);
+
+    if (l == s->loop) {
+        Stcp_make_pipe(s, fd, (struct sockaddr_in *)&addr);
+    } else {
+        nitro_async_t a = {NITRO_ASYNC_MAKE_PIPE};
+        a.u.make_pipe.socket = SOCKET_PARENT(s);
+        a.u.make_pipe.fd = fd;
+        memcpy(&a.u.make_pipe.addr, &addr, sizeof(struct sockaddr_in));
+        nitro_async_schedule(&a, l);
+    }
 }
 
 /*
@@ -1327,9 +1760,9 @@ void Stcp_pipe_out_cb(
     struct ev_loop *loop,
     ev_io *pipe_iow,
     int revents) {
-    NITRO_THREAD_CHECK;
     nitro_pipe_t *p = (nitro_pipe_t *)pipe_iow->data;
     nitro_tcp_socket_t *s = (nitro_tcp_socket_t *)p->the_socket;
+    NITRO_THREAD_CHECK(p->loop);
 
     int r = 0;
     int tried = 0;
@@ -1362,7 +1795,7 @@ void Stcp_pipe_out_cb(
     }
 
     if (s->opt->secure && !p->them_handshake) {
-        ev_io_stop(the_runtime->the_loop,
+        ev_io_stop(p->loop->the_loop,
                    pipe_iow);
         return;
 
@@ -1451,7 +1884,7 @@ void Stcp_pipe_out_cb(
 
     if (!tried) {
         // wait until we're enabled
-        ev_io_stop(the_runtime->the_loop,
+        ev_io_stop(p->loop->the_loop,
                    pipe_iow);
     }
 }
@@ -1470,13 +1903,36 @@ void Stcp_pipe_in_cb(
     ev_io *pipe_iow,
     int revents) {
     /* NOTE: this is on the security critical path */
-    NITRO_THREAD_CHECK;
     nitro_pipe_t *p = (nitro_pipe_t *)pipe_iow->data;
+    NITRO_THREAD_CHECK(p->loop);
+
+    /* DISABLE_READS reaches other loops asynchronously; until
+       it does, don't read anything the recv queue can't take */
+    if (Stcp_socket_recv_full((nitro_tcp_socket_t *)p->the_socket)) {
+        ev_io_stop(loop, pipe_iow);
+        return;
+    }
+
+    nitro_buffer_t *buf = p->in.buf;
+    size_t partial = Stcp_pipe_partial_size(p);
 
-    int sz = TCP_INBUF;
-    char *append_ptr = nitro_buffer_prepare(p->in_buffer, &sz);
+    /* A whole frame is already here: parsing stopped when the
+       recv queue filled.  Hand it over before reading more */
+    if (partial && p->in.start + partial <= buf->size) {
+        Stcp_parse_socket_buffer(p);
+        return;
+    }
 
-    int r = read(p->fd, append_ptr, sz);
+    /* Move on when this buffer is full, or when the frame
+       being read won't fit in what's left of it; reading the
+       rest here would only mean copying it out again */
+    if (buf->size == buf->alloc || p->in.start + partial > buf->alloc) {
+        Stcp_pipe_next_input(p);
+        buf = p->in.buf;
+    }
+
+    assert(buf->size < buf->alloc);
+    int r = read(p->fd, buf->area + buf->size, buf->alloc - buf->size);
 
     if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
         return;
@@ -1487,13 +1943,62 @@ void Stcp_pipe_in_cb(
         return;
     }
 
-    nitro_buffer_extend(p->in_buffer, r);
+    nitro_buffer_extend(buf, r);
     INCR_STAT((nitro_tcp_socket_t *)p->the_socket, p->bytes_recv, r);
 
     Stcp_parse_socket_buffer(p);
 
 }
 
+/*
+ * Stcp_prepare_frame
+ * ------------------
+ *
+ * Apply the socket's outbound options to a frame as it
+ * is queued: with compression on, swap a frame over the
+ * threshold for its deflated copy; with checksums on, mark
+ * it to carry a CRC32C trailer.  `held` is how many of
+ * the frame's references belong to this send and its
+ * caller; any others mean it may be on another queue, and
+ * marking it needs a copy.
+ *
+ * This is done by the sending thread, so the I/O thread
+ * never pays for the deflate, and a pub is compressed once
+ * for all of its subscribers.  (The CRC itself is taken
+ * when the frame's iovecs are built, after any routing
+ * stack is attached.)
+ */
+static nitro_frame_t *Stcp_prepare_frame(nitro_tcp_socket_t *s,
+        nitro_frame_t *fr, int held) {
+    uint32_t threshold = s->opt->compress_threshold;
+
+    if (threshold && nitro_frame_size(fr) > threshold) {
+        nitro_frame_t *deflated = compress_frame(fr);
+
+        if (deflated != fr) {
+            fr = deflated;
+            held = 1;
+        }
+    }
+
+    /* sendfile() frames never pass through user space to
+       be summed; secure frames are already authenticated */
+    if (s->opt->checksum && !s->opt->secure && !fr->checksum && !fr->file) {
+        if (fr->refs > held) {
+            /* shared (NITRO_REUSE); another socket may be
+               writing it out without one */
+            nitro_frame_t *copy = nitro_frame_copy_partial(fr, NULL);
+            nitro_frame_destroy(fr);
+            fr = copy;
+        }
+
+        fr->checksum = 1;
+        fr->iovec_set = 0;
+    }
+
+    return fr;
+}
+
 /*
  * Stcp_socket_send
  * ----------------
@@ -1504,6 +2009,21 @@ void Stcp_pipe_in_cb(
  * (PUBLIC API)
  */
 int Stcp_socket_send(nitro_tcp_socket_t *s, nitro_frame_t **frp, int flags) {
+    return Stcp_socket_send_timeout(s, frp,
+                                    (flags & NITRO_NOWAIT) ? 0 : -1, flags);
+}
+
+/*
+ * Stcp_socket_send_timeout
+ * ------------------------
+ *
+ * As Stcp_socket_send, but if the common queue is full, wait
+ * at most `timeout` seconds for room.
+ *
+ * (PUBLIC API)
+ */
+int Stcp_socket_send_timeout(nitro_tcp_socket_t *s, nitro_frame_t **frp,
+                             double timeout, int flags) {
     nitro_frame_t *fr = *frp;
 
     if (flags & NITRO_REUSE) {
@@ -1512,7 +2032,8 @@ int Stcp_socket_send(nitro_tcp_socket_t *s, nitro_frame_t **frp, int flags) {
         *frp = NULL;
     }
 
-    int r = nitro_queue_push(s->q_send, fr, !(flags & NITRO_NOWAIT));
+    fr = Stcp_prepare_frame(s, fr, (flags & NITRO_REUSE) ? 2 : 1);
+    int r = nitro_queue_push_timeout(s->q_send, fr, timeout);
 
     if (r) {
         nitro_frame_destroy(fr);
@@ -1521,6 +2042,85 @@ int Stcp_socket_send(nitro_tcp_socket_t *s, nitro_frame_t **frp, int flags) {
     return r;
 }
 
+/*
+ * Stcp_socket_send_many_prepared
+ * ------------------------------
+ *
+ * Stcp_socket_send_many with compression or checksums on.
+ * The queue may be given copies, so frames it doesn't take
+ * must be left to the caller as they were.
+ */
+static int Stcp_socket_send_many_prepared(nitro_tcp_socket_t *s,
+        nitro_frame_t **frames, int n, int flags) {
+    nitro_frame_t **out = malloc(n * sizeof(nitro_frame_t *));
+    int i;
+
+    for (i = 0; i < n; i++) {
+        /* a reference for the queue; preparing may trade it
+           for a copy */
+        nitro_frame_incref(frames[i]);
+        out[i] = Stcp_prepare_frame(s, frames[i], 2);
+    }
+
+    int r = nitro_queue_push_batch(s->q_send, out, n, !(flags & NITRO_NOWAIT));
+    int taken = r < 0 ? 0 : r;
+
+    for (i = 0; i < n; i++) {
+        if (i >= taken) {
+            nitro_frame_destroy(out[i]);
+        } else if (!(flags & NITRO_REUSE)) {
+            nitro_frame_destroy(frames[i]);
+            frames[i] = NULL;
+        }
+    }
+
+    free(out);
+    return r;
+}
+
+/*
+ * Stcp_socket_send_many
+ * ---------------------
+ *
+ * Send the `n` frames in `frames`, in order, with one trip
+ * through the common queue (and at most one writer wakeup).
+ *
+ * If the queue fills, only a prefix is taken; accepted frames
+ * are NULLed in `frames` (unless NITRO_REUSE), and the rest are
+ * left for the caller.  Returns the number accepted.
+ *
+ * (PUBLIC API)
+ */
+int Stcp_socket_send_many(nitro_tcp_socket_t *s, nitro_frame_t **frames,
+                          int n, int flags) {
+    int i;
+
+    if (s->opt->compress_threshold || s->opt->checksum) {
+        return Stcp_socket_send_many_prepared(s, frames, n, flags);
+    }
+
+    if (flags & NITRO_REUSE) {
+        for (i = 0; i < n; i++) {
+            nitro_frame_incref(frames[i]);
+        }
+    }
+
+    int r = nitro_queue_push_batch(s->q_send, frames, n, !(flags & NITRO_NOWAIT));
+    int taken = r < 0 ? 0 : r;
+
+    for (i = 0; i < n; i++) {
+        if (flags & NITRO_REUSE) {
+            if (i >= taken) {
+                nitro_frame_destroy(frames[i]);
+            }
+        } else if (i < taken) {
+            frames[i] = NULL;
+        }
+    }
+
+    return r;
+}
+
 /*
  * Stcp_socket_recv
  * ----------------
@@ -1534,6 +2134,32 @@ nitro_frame_t *Stcp_socket_recv(nitro_tcp_socket_t *s, int flags) {
     return nitro_queue_pull(s->q_recv, !(flags & NITRO_NOWAIT));
 }
 
+/*
+ * Stcp_socket_recv_timeout
+ * ------------------------
+ *
+ * As Stcp_socket_recv, but waiting at most `timeout` seconds
+ * for a frame.
+ *
+ * (PUBLIC API)
+ */
+nitro_frame_t *Stcp_socket_recv_timeout(nitro_tcp_socket_t *s, double timeout) {
+    return nitro_queue_pull_timeout(s->q_recv, timeout);
+}
+
+/*
+ * Stcp_socket_recv_many
+ * ---------------------
+ *
+ * Receive up to `max` queued frames into `frames` at once.
+ *
+ * (PUBLIC API)
+ */
+int Stcp_socket_recv_many(nitro_tcp_socket_t *s,
+                          nitro_frame_t **frames, int max, int flags) {
+    return nitro_queue_pull_batch(s->q_recv, frames, max, !(flags & NITRO_NOWAIT));
+}
+
 /*
  * Stcp_socket_reply
  * -----------------
@@ -1554,6 +2180,7 @@ int Stcp_socket_reply(nitro_tcp_socket_t *s,
         *frp = NULL;
     }
 
+    fr = Stcp_prepare_frame(s, fr, 1);
     int ret = -1;
     pthread_mutex_lock(&s->l_pipes);
     nitro_pipe_t *p = Stcp_lookup_pipe(s, snd->sender);
@@ -1594,6 +2221,7 @@ int Stcp_socket_relay_fw(nitro_tcp_socket_t *s,
         *frp = NULL;
     }
 
+    fr = Stcp_prepare_frame(s, fr, 1);
     nitro_frame_clone_stack(snd, fr);
     nitro_frame_set_sender(fr, snd->sender, snd->sender_buffer);
     nitro_frame_stack_push_sender(fr);
@@ -1628,6 +2256,7 @@ int Stcp_socket_relay_bk(nitro_tcp_socket_t *s,
         *frp = NULL;
     }
 
+    fr = Stcp_prepare_frame(s, fr, 1);
     int ret = -1;
     pthread_mutex_lock(&s->l_pipes);
 
@@ -1670,7 +2299,7 @@ static void Stcp_socket_reindex_subs(nitro_tcp_socket_t *s) {
     nitro_key_t *key;
     ++s->sub_keys_state;
     //    fprintf(stderr, "state changed to: %llu\n", (unsigned long long) s->sub_keys_state);
-    ev_timer_start(the_runtime->the_loop,
+    ev_timer_start(s->loop->the_loop,
                    &s->sub_send_timer);
 
     if (s->sub_data) {
@@ -1826,9 +2455,9 @@ static void Stcp_deliver_pub_frame(
         nitro_frame_t *fr = st->fr;
         nitro_frame_incref(fr);
 
-        /* we'll *try* to pub, but if queue is full, then
-           we're just gonna have to drop it (pub will not
-           block the caller) */
+        /* we'll *try* to pub, but if queue is full (and
+           can't spill), then we're just gonna have to drop
+           it (pub will not block the caller) */
         int r = nitro_queue_push(p->q_send, fr, 0);
 
         if (r) {
@@ -1863,7 +2492,13 @@ int Stcp_socket_pub(nitro_tcp_socket_t *s,
 
     Stcp_pub_state st = {0};
 
-    st.fr = fr;
+    st.fr = Stcp_prepare_frame(s, fr, (flags & NITRO_REUSE) ? 2 : 1);
+
+    /* The subscribers' pipes may be on different loops, all
+       writing out this one frame; build its header, iovecs
+       and checksum here, so they only ever read them */
+    int num;
+    nitro_frame_iovs(st.fr, &num);
 
     pthread_mutex_lock(&s->l_pipes);
 
@@ -1872,7 +2507,7 @@ int Stcp_socket_pub(nitro_tcp_socket_t *s,
 
     pthread_mutex_unlock(&s->l_pipes);
 
-    nitro_frame_destroy(fr);
+    nitro_frame_destroy(st.fr);
 
     return st.count;
 }
@@ -1972,7 +2607,7 @@ void Stcp_socket_describe(nitro_tcp_socket_t *s, nitro_buffer_t *buf) {
             strcpy(remote, "(none)");
         }
 
-        written = snprintf(ptr, amt, "C-%02x%02x%02x%02x tcp://%s (remote=%s, secure=%s, gen_q=%u, recv_q=%u gen_tot=%" PRIu64 ", recv_tot=%" PRIu64 ")\n",
+        written = snprintf(ptr, amt, "C-%02x%02x%02x%02x tcp://%s (remote=%s, secure=%s, gen_q=%u, recv_q=%u gen_tot=%" PRIu64 ", recv_tot=%" PRIu64 ", expired_tot=%" PRIu64 ", wakes_coalesced=%" PRIu64 ")\n",
                            SOCKET_UNIVERSAL(s)->opt->ident[0],
                            SOCKET_UNIVERSAL(s)->opt->ident[1],
                            SOCKET_UNIVERSAL(s)->opt->ident[2],
@@ -1983,11 +2618,13 @@ void Stcp_socket_describe(nitro_tcp_socket_t *s, nitro_buffer_t *buf) {
                            nitro_queue_count(s->q_send),
                            nitro_queue_count(s->q_recv),
                            s->stat_sent,
-                           s->stat_recv
+                           s->stat_recv,
+                           s->stat_expired,
+                           s->stat_wakes_coalesced
                           );
         nitro_buffer_extend(buf, written);
     } else {
-        written = snprintf(ptr, amt, "B-%02x%02x%02x%02x tcp://%s (peers=%d, secure=%s, gen_q=%u, recv_q=%u, gen_tot=%" PRIu64 ", recv_tot=%" PRIu64 ", direct_tot=%" PRIu64 ")\n",
+        written = snprintf(ptr, amt, "B-%02x%02x%02x%02x tcp://%s (peers=%d, secure=%s, gen_q=%u, recv_q=%u, gen_tot=%" PRIu64 ", recv_tot=%" PRIu64 ", direct_tot=%" PRIu64 ", expired_tot=%" PRIu64 ", wakes_coalesced=%" PRIu64 ")\n",
                            SOCKET_UNIVERSAL(s)->opt->ident[0],
                            SOCKET_UNIVERSAL(s)->opt->ident[1],
                            SOCKET_UNIVERSAL(s)->opt->ident[2],
@@ -1999,7 +2636,9 @@ void Stcp_socket_describe(nitro_tcp_socket_t *s, nitro_buffer_t *buf) {
                            nitro_queue_count(s->q_recv),
                            s->stat_sent,
                            s->stat_recv,
-                           s->stat_direct
+                           s->stat_direct,
+                           s->stat_expired,
+                           s->stat_wakes_coalesced
                           );
         nitro_buffer_extend(buf, written);
 
@@ -2020,7 +2659,7 @@ void Stcp_socket_describe(nitro_tcp_socket_t *s, nitro_buffer_t *buf) {
                 strcpy(remote, "????????");
             }
 
-            written = snprintf(ptr, amt, "  -> %s on %s for %.1fs (gen=%" PRIu64 ", recv=%" PRIu64 ", direct=%" PRIu64 ", direct_q=%u, bytes_out=%" PRIu64 ", bytes_in=%" PRIu64 ")\n",
+            written = snprintf(ptr, amt, "  -> %s on %s for %.1fs (gen=%" PRIu64 ", recv=%" PRIu64 ", direct=%" PRIu64 ", direct_q=%u, bytes_out=%" PRIu64 ", bytes_in=%" PRIu64 ", wakes_coalesced=%" PRIu64 ")\n",
                                remote,
                                p->remote_location,
                                now - p->born,
@@ -2029,7 +2668,8 @@ void Stcp_socket_describe(nitro_tcp_socket_t *s, nitro_buffer_t *buf) {
                                p->stat_direct,
                                nitro_queue_count(p->q_send),
                                p->bytes_sent,
-                               p->bytes_recv
+                               p->bytes_recv,
+                               p->stat_wakes_coalesced
                               );
             nitro_buffer_extend(buf, written);
         }
@@ -44,11 +44,21 @@ void Stcp_socket_close(nitro_tcp_socket_t *s);
 void Stcp_socket_bind_listen(nitro_tcp_socket_t *s);
 void Stcp_socket_enable_writes(nitro_tcp_socket_t *s);
 void Stcp_socket_enable_reads(nitro_tcp_socket_t *s);
+void Stcp_socket_disable_loop_reads(nitro_tcp_socket_t *s, struct nitro_loop_t *l);
+void Stcp_socket_close_loop_pipes(nitro_tcp_socket_t *s, struct nitro_loop_t *l);
+void Stcp_make_pipe(nitro_tcp_socket_t *s, int fd, struct sockaddr_in *addr);
 void Stcp_socket_start_connect(nitro_tcp_socket_t *s);
 void Stcp_socket_start_shutdown(nitro_tcp_socket_t *s);
 
 int Stcp_socket_send(nitro_tcp_socket_t *s, nitro_frame_t **frp, int flags);
+int Stcp_socket_send_timeout(nitro_tcp_socket_t *s, nitro_frame_t **frp,
+                             double timeout, int flags);
+int Stcp_socket_send_many(nitro_tcp_socket_t *s, nitro_frame_t **frames,
+                          int n, int flags);
 nitro_frame_t *Stcp_socket_recv(nitro_tcp_socket_t *s, int flags);
+nitro_frame_t *Stcp_socket_recv_timeout(nitro_tcp_socket_t *s, double timeout);
+int Stcp_socket_recv_many(nitro_tcp_socket_t *s,
+                          nitro_frame_t **frames, int max, int flags);
 int Stcp_socket_reply(nitro_tcp_socket_t *s, nitro_frame_t *snd, nitro_frame_t **frp, int flags);
 void Stcp_pipe_enable_write(nitro_pipe_t *p);
 int Stcp_socket_relay_fw(nitro_tcp_socket_t *s, nitro_frame_t *snd, nitro_frame_t **frp, int flags);
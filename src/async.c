@@ -38,29 +38,154 @@
 #include "Stcp.h"
 #include "Sinproc.h"
 
-nitro_async_t *nitro_async_new(int type) {
-    /* eventually.. pool? */
-    nitro_async_t *a;
-    ZALLOC(a);
-    a->type = type;
-    return a;
+void nitro_async_ring_init(nitro_async_ring *r) {
+    size_t i;
+    r->cells = malloc(NITRO_ASYNC_RING_SIZE * sizeof(nitro_async_cell));
+
+    for (i = 0; i < NITRO_ASYNC_RING_SIZE; i++) {
+        r->cells[i].seq = i;
+    }
+
+    r->enqueue_pos = 0;
+    r->dequeue_pos = 0;
+    r->overflow_count = 0;
+    r->overflow = r->overflow_tail = NULL;
+    r->handled = 0;
+    pthread_mutex_init(&r->l_overflow, NULL);
+}
+
+void nitro_async_ring_destroy(nitro_async_ring *r) {
+    nitro_async_t *a, *tmp;
+
+    LL_FOREACH_SAFE(r->overflow, a, tmp) {
+        free(a);
+    }
+
+    free(r->cells);
+    pthread_mutex_destroy(&r->l_overflow);
+}
+
+/*
+ * nitro_async_ring_push
+ * ---------------------
+ *
+ * Claim a cell and copy `a` into it.  Returns -1 if the ring
+ * is full.
+ */
+static int nitro_async_ring_push(nitro_async_ring *r, nitro_async_t *a) {
+    nitro_async_cell *cell;
+    size_t pos = r->enqueue_pos;
+
+    while (1) {
+        cell = &r->cells[pos & (NITRO_ASYNC_RING_SIZE - 1)];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&r->enqueue_pos, &pos, pos + 1,
+                                            1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&r->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->cmd = *a;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
 }
 
-static void nitro_async_destroy(nitro_async_t *a) {
-    /* eventually.. pool? */
-    free(a);
+/*
+ * nitro_async_ring_pop
+ * --------------------
+ *
+ * Copy the oldest command out of the ring (loop thread only).
+ * Returns -1 if nothing is ready.
+ */
+static int nitro_async_ring_pop(nitro_async_ring *r, nitro_async_t *out) {
+    size_t pos = r->dequeue_pos;
+    nitro_async_cell *cell = &r->cells[pos & (NITRO_ASYNC_RING_SIZE - 1)];
+    size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+
+    if (seq != pos + 1) {
+        return -1;
+    }
+
+    *out = cell->cmd;
+    r->dequeue_pos = pos + 1;
+    __atomic_store_n(&cell->seq, pos + NITRO_ASYNC_RING_SIZE, __ATOMIC_RELEASE);
+    return 0;
 }
 
-void nitro_async_schedule(nitro_async_t *a) {
-    pthread_mutex_lock(&the_runtime->l_async);
-    LL_APPEND(the_runtime->async_queue, a);
-    pthread_mutex_unlock(&the_runtime->l_async);
-    ev_async_send(the_runtime->the_loop,
-                  &the_runtime->thread_wake);
+/*
+ * nitro_async_schedule
+ * --------------------
+ *
+ * Hand a command to loop `l`.  The command is copied, so
+ * callers can build it on the stack.
+ *
+ * Once anything is in the overflow list, later commands go
+ * there too so that each producer's commands stay in order.
+ */
+void nitro_async_schedule(nitro_async_t *a, nitro_loop_t *l) {
+    nitro_async_ring *r = &l->async_ring;
+
+    if (!__atomic_load_n(&r->overflow_count, __ATOMIC_ACQUIRE)) {
+        if (!nitro_async_ring_push(r, a)) {
+            goto wake;
+        }
+
+        /* give the loop a chance to drain, unless we *are* the loop */
+        if (nitro_runtime_current_loop() != l) {
+            int tries;
+
+            for (tries = 0; tries < NITRO_ASYNC_RING_RETRIES; tries++) {
+                ev_async_send(l->the_loop, &l->thread_wake);
+                sched_yield();
+
+                if (!nitro_async_ring_push(r, a)) {
+                    goto wake;
+                }
+            }
+        }
+    }
+
+    nitro_async_t *copy;
+    ZALLOC(copy);
+    *copy = *a;
+    copy->next = NULL;
+
+    pthread_mutex_lock(&r->l_overflow);
+
+    if (r->overflow_tail) {
+        r->overflow_tail->next = copy;
+    } else {
+        r->overflow = copy;
+    }
+
+    r->overflow_tail = copy;
+    __atomic_add_fetch(&r->overflow_count, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&r->l_overflow);
+
+wake:
+
+    /* embedded loops drain their own commands before blocking */
+    if (l->embedded && nitro_runtime_current_loop() == l) {
+        return;
+    }
+
+    ev_async_send(l->the_loop,
+                  &l->thread_wake);
 }
 
-static void nitro_async_handle(nitro_async_t *a) {
+static void nitro_async_handle(nitro_async_t *a, nitro_loop_t *l) {
     switch (a->type) {
+    case NITRO_ASYNC_NOOP:
+        break;
+
     case NITRO_ASYNC_ENABLE_WRITES:
         if (a->u.enable_writes.pipe) {
             Stcp_pipe_enable_write(a->u.enable_writes.pipe);
@@ -71,11 +196,24 @@ static void nitro_async_handle(nitro_async_t *a) {
         break;
 
     case NITRO_ASYNC_ENABLE_READS:
-        SOCKET_CALL(a->u.bind_listen.socket, enable_reads);
+        SOCKET_CALL(a->u.enable_reads.socket, enable_reads);
+        break;
+
+    case NITRO_ASYNC_DISABLE_READS:
+        Stcp_socket_disable_loop_reads(&a->u.disable_reads.socket->stype.tcp, l);
+        break;
+
+    case NITRO_ASYNC_MAKE_PIPE:
+        Stcp_make_pipe(&a->u.make_pipe.socket->stype.tcp,
+                       a->u.make_pipe.fd, &a->u.make_pipe.addr);
+        break;
+
+    case NITRO_ASYNC_CLOSE_PIPES:
+        Stcp_socket_close_loop_pipes(&a->u.close_pipes.socket->stype.tcp, l);
         break;
 
     case NITRO_ASYNC_DIE:
-        ev_break(the_runtime->the_loop, EVBREAK_ALL);
+        ev_break(l->the_loop, EVBREAK_ALL);
         break;
 
     case NITRO_ASYNC_BIND_LISTEN:
@@ -93,15 +231,39 @@ static void nitro_async_handle(nitro_async_t *a) {
 }
 
 void nitro_async_cb(struct ev_loop *loop, ev_async *a, int revents) {
-    nitro_async_t *head, *next;
-    pthread_mutex_lock(&the_runtime->l_async);
-    head = the_runtime->async_queue;
-    the_runtime->async_queue = NULL;
-    pthread_mutex_unlock(&the_runtime->l_async);
-
-    for (; head; head = next) {
-        next = head->next;
-        nitro_async_handle((nitro_async_t *)head);
-        nitro_async_destroy((nitro_async_t *)head);
+    nitro_loop_t *l = (nitro_loop_t *)a->data;
+    nitro_async_ring *r = &l->async_ring;
+    nitro_async_t cmd, *head, *next;
+
+    while (1) {
+        while (!nitro_async_ring_pop(r, &cmd)) {
+            nitro_async_handle(&cmd, l);
+            ++r->handled;
+        }
+
+        if (!__atomic_load_n(&r->overflow_count, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        pthread_mutex_lock(&r->l_overflow);
+        head = r->overflow;
+        r->overflow = r->overflow_tail = NULL;
+        pthread_mutex_unlock(&r->l_overflow);
+
+        for (; head; head = next) {
+            next = head->next;
+            nitro_async_handle(head, l);
+            ++r->handled;
+            free(head);
+        }
+
+        /* only once it's drained may producers use the ring again */
+        pthread_mutex_lock(&r->l_overflow);
+
+        if (!r->overflow) {
+            __atomic_store_n(&r->overflow_count, 0, __ATOMIC_RELEASE);
+        }
+
+        pthread_mutex_unlock(&r->l_overflow);
     }
 }
@@ -39,13 +39,24 @@
 
 #include "socket.h"
 
+struct nitro_loop_t;
+
+/* Slots in each loop's command ring; must be a power of two */
+#define NITRO_ASYNC_RING_SIZE 4096
+/* Times a full ring is retried before spilling to the overflow list */
+#define NITRO_ASYNC_RING_RETRIES 64
+
 enum {
+    NITRO_ASYNC_NOOP,
     NITRO_ASYNC_DIE,
     NITRO_ASYNC_BIND_LISTEN,
     NITRO_ASYNC_CONNECT,
     NITRO_ASYNC_CLOSE,
     NITRO_ASYNC_ENABLE_WRITES,
-    NITRO_ASYNC_ENABLE_READS
+    NITRO_ASYNC_ENABLE_READS,
+    NITRO_ASYNC_DISABLE_READS,
+    NITRO_ASYNC_MAKE_PIPE,
+    NITRO_ASYNC_CLOSE_PIPES
 };
 
 typedef struct nitro_async_tcp_flush {
@@ -69,10 +80,24 @@ typedef struct nitro_async_enable_reads {
     nitro_socket_t *socket;
 } nitro_async_enable_reads;
 
+typedef struct nitro_async_disable_reads {
+    nitro_socket_t *socket;
+} nitro_async_disable_reads;
+
+typedef struct nitro_async_make_pipe {
+    nitro_socket_t *socket;
+    int fd;
+    struct sockaddr_in addr;
+} nitro_async_make_pipe;
+
 typedef struct nitro_async_close {
     nitro_socket_t *socket;
 } nitro_async_close;
 
+typedef struct nitro_async_close_pipes {
+    nitro_socket_t *socket;
+} nitro_async_close_pipes;
+
 typedef struct nitro_async {
     int type;
     union {
@@ -80,13 +105,43 @@ typedef struct nitro_async {
         nitro_async_connect connect;
         nitro_async_enable_writes enable_writes;
         nitro_async_enable_reads enable_reads;
+        nitro_async_disable_reads disable_reads;
+        nitro_async_make_pipe make_pipe;
         nitro_async_close close;
+        nitro_async_close_pipes close_pipes;
     } u;
     struct nitro_async *next;
 } nitro_async_t;
 
+typedef struct nitro_async_cell {
+    size_t seq;
+    nitro_async_t cmd;
+} nitro_async_cell;
+
+/*
+ * Bounded multi-producer, single-consumer ring of commands.
+ * Producers claim a cell with a CAS on `enqueue_pos` and
+ * publish it by bumping the cell's `seq`; only the loop
+ * thread consumes.  If the ring stays full, commands spill
+ * to a locked `overflow` list until the loop catches up.
+ */
+typedef struct nitro_async_ring {
+    size_t enqueue_pos __attribute__((aligned(64)));
+    size_t dequeue_pos __attribute__((aligned(64)));
+    nitro_async_cell *cells;
+
+    int overflow_count;
+    nitro_async_t *overflow;
+    nitro_async_t *overflow_tail;
+    pthread_mutex_t l_overflow;
+
+    /* commands run so far (written by the loop thread only) */
+    uint64_t handled;
+} nitro_async_ring;
+
 void nitro_async_cb(struct ev_loop *loop, ev_async *a, int revents);
-nitro_async_t *nitro_async_new(int type);
-void nitro_async_schedule(nitro_async_t *a);
+void nitro_async_ring_init(nitro_async_ring *r);
+void nitro_async_ring_destroy(nitro_async_ring *r);
+void nitro_async_schedule(nitro_async_t *a, struct nitro_loop_t *l);
 
 #endif /* ASYNC_H */
@@ -38,11 +38,26 @@
 
 #include "common.h"
 #include "buffer.h"
+#include "pool.h"
 #include "util.h"
 
 #define START_SIZE 1024
 
+/* A segment is one pool object: the struct, then its area */
+static nitro_pool_t nitro_segment_pool = NITRO_POOL_INIT_SIZED(
+            sizeof(nitro_buffer_t) + NITRO_BUFFER_SEGMENT, NITRO_POOL_SEGMENT, 4, 8);
+
+uint64_t nitro_buffer_stat_pinned;
+uint64_t nitro_buffer_stat_referenced;
+
 static void nitro_buffer_grow(nitro_buffer_t *buf) {
+    if (buf->alloc >= buf->size) {
+        return;
+    }
+
+    /* frames may point into a segment; it never moves */
+    assert(!buf->segment);
+
     while (buf->alloc < buf->size) {
         if (!buf->alloc) {
             buf->alloc = START_SIZE;
@@ -60,6 +75,46 @@ nitro_buffer_t *nitro_buffer_new() {
     return buf;
 }
 
+/* Room for exactly `size` bytes, for data of known length */
+nitro_buffer_t *nitro_buffer_new_exact(int size) {
+    nitro_buffer_t *buf;
+    ZALLOC(buf);
+    buf->area = malloc(size);
+    buf->alloc = size;
+    return buf;
+}
+
+/*
+ * A fixed size buffer from a pool, for reading from the
+ * network.  It is never grown, so frames can point into
+ * the start of one while more is read into the rest.
+ */
+nitro_buffer_t *nitro_buffer_new_segment() {
+    nitro_buffer_t *buf = nitro_pool_alloc(&nitro_segment_pool);
+    buf->area = (char *)(buf + 1);
+    buf->alloc = NITRO_BUFFER_SEGMENT;
+    buf->size = 0;
+    buf->segment = 1;
+    buf->pinned = 0;
+    return buf;
+}
+
+/* A frame now points into `buf`; count it as pinned */
+void nitro_buffer_pin(nitro_buffer_t *buf) {
+    if (!buf->pinned) {
+        buf->pinned = 1;
+        __sync_fetch_and_add(&nitro_buffer_stat_pinned, buf->alloc);
+    }
+}
+
+/* No frame points into `buf` any longer */
+void nitro_buffer_unpin(nitro_buffer_t *buf) {
+    if (buf->pinned) {
+        buf->pinned = 0;
+        __sync_fetch_and_sub(&nitro_buffer_stat_pinned, buf->alloc);
+    }
+}
+
 void nitro_buffer_append(nitro_buffer_t *buf, const char *s, int bytes) {
     int old_size = buf->size;
     buf->size += bytes;
@@ -77,6 +132,13 @@ char *nitro_buffer_data(nitro_buffer_t *buf, int *size) {
 }
 
 void nitro_buffer_destroy(nitro_buffer_t *buf) {
+    nitro_buffer_unpin(buf);
+
+    if (buf->segment) {
+        nitro_pool_free(&nitro_segment_pool, buf);
+        return;
+    }
+
     free(buf->area);
     free(buf);
 }
@@ -96,3 +158,10 @@ void nitro_buffer_extend(nitro_buffer_t *buf, int bytes) {
     buf->size += bytes;
     assert(buf->size <= buf->alloc);
 }
+
+/* Drop `bytes` from the front, keeping the allocation */
+void nitro_buffer_shift(nitro_buffer_t *buf, int bytes) {
+    assert(bytes <= buf->size);
+    buf->size -= bytes;
+    memmove(buf->area, buf->area + bytes, buf->size);
+}
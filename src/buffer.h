@@ -35,17 +35,37 @@
 #ifndef NITRO_BUFFER_H
 #define NITRO_BUFFER_H
 
+#include "common.h"
+
+/* Size of a receive segment (see nitro_buffer_new_segment) */
+#define NITRO_BUFFER_SEGMENT (128 * 1024)
+
 typedef struct nitro_buffer_t {
     char *area;
     size_t alloc;
     size_t size;
+    /* pooled, fixed size; area follows the struct */
+    int segment;
+    /* frames point into it (counted in nitro_buffer_stat_pinned) */
+    int pinned;
 } nitro_buffer_t;
 
+/* Receive buffer bytes kept alive by frames pointing into
+   them, and the frame data they point at (see
+   nitro_recv_retention) */
+extern uint64_t nitro_buffer_stat_pinned;
+extern uint64_t nitro_buffer_stat_referenced;
+
 nitro_buffer_t *nitro_buffer_new();
+nitro_buffer_t *nitro_buffer_new_exact(int size);
+nitro_buffer_t *nitro_buffer_new_segment();
+void nitro_buffer_pin(nitro_buffer_t *buf);
+void nitro_buffer_unpin(nitro_buffer_t *buf);
 void nitro_buffer_append(nitro_buffer_t *buf, const char *s, int bytes);
 char *nitro_buffer_data(nitro_buffer_t *buf, int *size);
 char *nitro_buffer_prepare(nitro_buffer_t *buf, int *growth);
 void nitro_buffer_extend(nitro_buffer_t *buf, int bytes);
+void nitro_buffer_shift(nitro_buffer_t *buf, int bytes);
 void nitro_buffer_destroy(nitro_buffer_t *buf);
 
 #endif /* BUFFER_H */
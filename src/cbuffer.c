@@ -35,9 +35,11 @@
 
 #include "cbuffer.h"
 
+nitro_pool_t nitro_cbuffer_pool = NITRO_POOL_INIT(nitro_counted_buffer_t, NITRO_POOL_CBUFFER);
+
 nitro_counted_buffer_t *nitro_counted_buffer_new(void *backing, nitro_free_function ff, void *baton) {
     nitro_counted_buffer_t *buf;
-    buf = malloc(sizeof(nitro_counted_buffer_t));
+    buf = nitro_pool_alloc(&nitro_cbuffer_pool);
     buf->ptr = backing;
     buf->count = 1;
     buf->ff = ff;
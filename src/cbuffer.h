@@ -38,6 +38,7 @@
 #include "common.h"
 
 #include "util.h"
+#include "pool.h"
 
 typedef struct nitro_counted_buffer_t {
     void *ptr;
@@ -46,6 +47,8 @@ typedef struct nitro_counted_buffer_t {
     void *baton;
 } nitro_counted_buffer_t;
 
+extern nitro_pool_t nitro_cbuffer_pool;
+
 nitro_counted_buffer_t *nitro_counted_buffer_new(void *backing, nitro_free_function ff, void *baton);
 
 #define nitro_counted_buffer_decref(buf) {\
@@ -54,7 +57,7 @@ nitro_counted_buffer_t *nitro_counted_buffer_new(void *backing, nitro_free_funct
             if ((__tmp_buf)->ff) {\
                 (__tmp_buf)->ff((__tmp_buf)->ptr, (__tmp_buf)->baton);\
             }\
-            free((__tmp_buf));\
+            nitro_pool_free(&nitro_cbuffer_pool, (__tmp_buf));\
         }\
     }
 
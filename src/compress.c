@@ -0,0 +1,217 @@
+/*
+ * Nitro
+ *
+ * compress.c - zlib payload compression for Stcp sockets.
+ *
+ *  -- LICENSE --
+ *
+ * Copyright 2013 Bump Technologies, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BUMP TECHNOLOGIES, INC. ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP TECHNOLOGIES, INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of Bump Technologies, Inc.
+ *
+ */
+#include "common.h"
+#include "compress.h"
+#include "err.h"
+
+#include <zlib.h>
+
+/*
+ * A compressed payload is the original size (uint32_t),
+ * then the zlib stream, and the frame carries
+ * NITRO_FRAME_COMPRESSED in its protocol header flags.
+ * Level 1: on a fast link the deflate has to keep up.
+ *
+ * Setting up a z_stream allocates and clears a few hundred
+ * KB, so each thread keeps one of each and resets it per
+ * frame; they are freed when the thread exits.
+ */
+#define COMPRESS_LEVEL Z_BEST_SPEED
+
+typedef struct compress_streams {
+    z_stream deflate;
+    z_stream inflate;
+    int has_deflate;
+    int has_inflate;
+} compress_streams;
+
+static __thread compress_streams *thread_streams;
+static pthread_once_t compress_once = PTHREAD_ONCE_INIT;
+static pthread_key_t compress_key;
+
+static void compress_thread_exit(void *p) {
+    compress_streams *zs = (compress_streams *)p;
+
+    if (zs->has_deflate) {
+        deflateEnd(&zs->deflate);
+    }
+
+    if (zs->has_inflate) {
+        inflateEnd(&zs->inflate);
+    }
+
+    free(zs);
+}
+
+static void compress_key_init() {
+    pthread_key_create(&compress_key, compress_thread_exit);
+}
+
+static compress_streams *compress_thread_streams() {
+    if (!thread_streams) {
+        pthread_once(&compress_once, compress_key_init);
+        ZALLOC(thread_streams);
+        pthread_setspecific(compress_key, thread_streams);
+    }
+
+    return thread_streams;
+}
+
+static z_stream *compress_deflater() {
+    compress_streams *zs = compress_thread_streams();
+
+    if (zs->has_deflate) {
+        deflateReset(&zs->deflate);
+    } else if (deflateInit(&zs->deflate, COMPRESS_LEVEL) == Z_OK) {
+        zs->has_deflate = 1;
+    } else {
+        return NULL;
+    }
+
+    return &zs->deflate;
+}
+
+static z_stream *compress_inflater() {
+    compress_streams *zs = compress_thread_streams();
+
+    if (zs->has_inflate) {
+        inflateReset(&zs->inflate);
+    } else if (inflateInit(&zs->inflate) == Z_OK) {
+        zs->has_inflate = 1;
+    } else {
+        return NULL;
+    }
+
+    return &zs->inflate;
+}
+
+/*
+ * compress_frame
+ * --------------
+ *
+ * Take over `fr` and return a compressed frame in its
+ * place, with the same priority, deadline and routing.
+ * If deflate does not make it smaller (or it is a file
+ * frame, which is meant to go out by sendfile), `fr` is
+ * returned as is.
+ */
+nitro_frame_t *compress_frame(nitro_frame_t *fr) {
+    if (fr->compressed || fr->file || fr->type != NITRO_FRAME_DATA) {
+        return fr;
+    }
+
+    uint32_t size = nitro_frame_size(fr);
+    z_stream *z = compress_deflater();
+
+    if (!z || size <= sizeof(uint32_t)) {
+        return fr;
+    }
+
+    /* no room for anything that doesn't shrink; deflate
+       stops as soon as it runs out */
+    uint8_t *out = malloc(size);
+    z->next_in = nitro_frame_data(fr);
+    z->avail_in = size;
+    z->next_out = out + sizeof(uint32_t);
+    z->avail_out = size - sizeof(uint32_t) - 1;
+
+    if (deflate(z, Z_FINISH) != Z_STREAM_END) {
+        free(out);
+        return fr;
+    }
+
+    uint32_t out_size = sizeof(uint32_t) + z->total_out;
+    memcpy(out, &size, sizeof(uint32_t));
+    out = realloc(out, out_size);
+
+    nitro_frame_t *c = nitro_frame_new_heap(out, out_size);
+    c->compressed = 1;
+    c->priority = fr->priority;
+    c->deadline = fr->deadline;
+    nitro_frame_clone_stack(fr, c);
+
+    if (fr->sender) {
+        nitro_frame_set_sender(c, fr->sender, fr->sender_buffer);
+    }
+
+    c->push_sender = fr->push_sender;
+    nitro_frame_destroy(fr);
+
+    return c;
+}
+
+/*
+ * compress_inflate
+ * ----------------
+ *
+ * Inflate a received payload into a new malloc()ed buffer.
+ * The claimed size is checked against `max_size` first, so a
+ * peer can't make us allocate more than a plain frame could.
+ *
+ * Returns NULL (NITRO_ERR_BAD_COMPRESSED) if the payload
+ * is not what compress_frame makes.
+ */
+uint8_t *compress_inflate(const uint8_t *data, uint32_t size,
+                          uint32_t max_size, uint32_t *out_size) {
+    uint32_t want;
+
+    if (size < sizeof(uint32_t)) {
+        nitro_set_error(NITRO_ERR_BAD_COMPRESSED);
+        return NULL;
+    }
+
+    memcpy(&want, data, sizeof(uint32_t));
+    z_stream *z = compress_inflater();
+
+    if (!z || want > max_size) {
+        nitro_set_error(NITRO_ERR_BAD_COMPRESSED);
+        return NULL;
+    }
+
+    uint8_t *out = malloc(want ? want : 1);
+    z->next_in = (uint8_t *)data + sizeof(uint32_t);
+    z->avail_in = size - sizeof(uint32_t);
+    z->next_out = out;
+    z->avail_out = want;
+
+    if (inflate(z, Z_FINISH) != Z_STREAM_END || z->total_out != want) {
+        free(out);
+        nitro_set_error(NITRO_ERR_BAD_COMPRESSED);
+        return NULL;
+    }
+
+    *out_size = want;
+    return out;
+}
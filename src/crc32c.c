@@ -0,0 +1,266 @@
+/*
+ * Nitro
+ *
+ * crc32c.c - CRC32C (Castagnoli) checksums for frame integrity
+ *
+ *  -- LICENSE --
+ *
+ * Copyright 2013 Bump Technologies, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BUMP TECHNOLOGIES, INC. ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP TECHNOLOGIES, INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of Bump Technologies, Inc.
+ *
+ */
+#include "crc32c.h"
+
+/*
+ * CRC32C, the Castagnoli polynomial, as used by iSCSI and
+ * SCTP (check value 0xE3069283 for "123456789").
+ *
+ * On x86_64 with SSE4.2 the crc32 instruction does the work;
+ * one instruction takes 8 bytes but has a 3 cycle latency,
+ * so long buffers are run as three interleaved streams and
+ * the results combined by "shifting" the earlier CRCs past
+ * the later data (Mark Adler's method).  Elsewhere a
+ * slicing-by-8 table does 8 bytes per step.
+ */
+#define CRC32C_POLY 0x82f63b78
+
+/* stream lengths for the interleaved loops; powers of two */
+#define CRC32C_LONG 8192
+#define CRC32C_SHORT 256
+
+static uint32_t crc32c_table[8][256];
+static uint32_t crc32c_long[4][256];
+static uint32_t crc32c_short[4][256];
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const uint8_t *p, size_t len);
+static crc32c_fn crc32c_impl;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/* GF(2) matrix times vector; the matrix is 32 column vectors */
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec) {
+    uint32_t sum = 0;
+
+    for (; vec; vec >>= 1, mat++) {
+        if (vec & 1) {
+            sum ^= *mat;
+        }
+    }
+
+    return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat) {
+    int n;
+
+    for (n = 0; n < 32; n++) {
+        square[n] = gf2_matrix_times(mat, mat[n]);
+    }
+}
+
+/* The operator that runs a CRC over `len` zero bytes
+   (`len` a power of two), by repeated squaring of the
+   one zero bit operator */
+static void crc32c_zeros_op(uint32_t *even, size_t len) {
+    uint32_t odd[32];
+    uint32_t row = 1;
+    int n;
+
+    odd[0] = CRC32C_POLY;
+
+    for (n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    /* two zero bits, then four */
+    gf2_matrix_square(even, odd);
+    gf2_matrix_square(odd, even);
+
+    /* one zero byte, two, four... */
+    do {
+        gf2_matrix_square(even, odd);
+        len >>= 1;
+
+        if (!len) {
+            return;
+        }
+
+        gf2_matrix_square(odd, even);
+        len >>= 1;
+    } while (len);
+
+    memcpy(even, odd, sizeof(odd));
+}
+
+/* The same operator, as a table per byte of the CRC */
+static void crc32c_zeros(uint32_t zeros[][256], size_t len) {
+    uint32_t op[32];
+    uint32_t n;
+
+    crc32c_zeros_op(op, len);
+
+    for (n = 0; n < 256; n++) {
+        zeros[0][n] = gf2_matrix_times(op, n);
+        zeros[1][n] = gf2_matrix_times(op, n << 8);
+        zeros[2][n] = gf2_matrix_times(op, n << 16);
+        zeros[3][n] = gf2_matrix_times(op, n << 24);
+    }
+}
+
+static inline uint32_t crc32c_shift(uint32_t zeros[][256], uint32_t crc) {
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+           zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+static uint32_t crc32c_table_run(uint32_t crc, const uint8_t *p, size_t len) {
+    while (len && ((uintptr_t)p & 7)) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+
+    for (; len >= 8; len -= 8, p += 8) {
+        crc ^= p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+        crc = crc32c_table[7][crc & 0xff] ^
+              crc32c_table[6][(crc >> 8) & 0xff] ^
+              crc32c_table[5][(crc >> 16) & 0xff] ^
+              crc32c_table[4][crc >> 24] ^
+              crc32c_table[3][p[4]] ^ crc32c_table[2][p[5]] ^
+              crc32c_table[1][p[6]] ^ crc32c_table[0][p[7]];
+    }
+
+    while (len--) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+
+#define CRC32C_HW
+
+static inline uint64_t crc32c_load(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw_run(uint32_t crc, const uint8_t *p, size_t len) {
+    uint64_t crc0 = crc, crc1, crc2;
+    const uint8_t *end;
+
+    while (len && ((uintptr_t)p & 7)) {
+        crc0 = _mm_crc32_u8(crc0, *p++);
+        len--;
+    }
+
+    while (len >= CRC32C_LONG * 3) {
+        crc1 = crc2 = 0;
+
+        for (end = p + CRC32C_LONG; p < end; p += 8) {
+            crc0 = _mm_crc32_u64(crc0, crc32c_load(p));
+            crc1 = _mm_crc32_u64(crc1, crc32c_load(p + CRC32C_LONG));
+            crc2 = _mm_crc32_u64(crc2, crc32c_load(p + CRC32C_LONG * 2));
+        }
+
+        crc0 = crc32c_shift(crc32c_long, crc0) ^ crc1;
+        crc0 = crc32c_shift(crc32c_long, crc0) ^ crc2;
+        p += CRC32C_LONG * 2;
+        len -= CRC32C_LONG * 3;
+    }
+
+    while (len >= CRC32C_SHORT * 3) {
+        crc1 = crc2 = 0;
+
+        for (end = p + CRC32C_SHORT; p < end; p += 8) {
+            crc0 = _mm_crc32_u64(crc0, crc32c_load(p));
+            crc1 = _mm_crc32_u64(crc1, crc32c_load(p + CRC32C_SHORT));
+            crc2 = _mm_crc32_u64(crc2, crc32c_load(p + CRC32C_SHORT * 2));
+        }
+
+        crc0 = crc32c_shift(crc32c_short, crc0) ^ crc1;
+        crc0 = crc32c_shift(crc32c_short, crc0) ^ crc2;
+        p += CRC32C_SHORT * 2;
+        len -= CRC32C_SHORT * 3;
+    }
+
+    for (; len >= 8; len -= 8, p += 8) {
+        crc0 = _mm_crc32_u64(crc0, crc32c_load(p));
+    }
+
+    while (len--) {
+        crc0 = _mm_crc32_u8(crc0, *p++);
+    }
+
+    return crc0;
+}
+#endif
+
+static void crc32c_init() {
+    uint32_t n, k, crc;
+
+    for (n = 0; n < 256; n++) {
+        crc = n;
+
+        for (k = 0; k < 8; k++) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+
+        crc32c_table[0][n] = crc;
+    }
+
+    for (n = 0; n < 256; n++) {
+        crc = crc32c_table[0][n];
+
+        for (k = 1; k < 8; k++) {
+            crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+            crc32c_table[k][n] = crc;
+        }
+    }
+
+    crc32c_impl = crc32c_table_run;
+
+#ifdef CRC32C_HW
+    crc32c_zeros(crc32c_long, CRC32C_LONG);
+    crc32c_zeros(crc32c_short, CRC32C_SHORT);
+
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32c_impl = crc32c_hw_run;
+    }
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&crc32c_once, crc32c_init);
+    return ~crc32c_impl(~crc, (const uint8_t *)data, len);
+}
+
+uint32_t crc32c_sw(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&crc32c_once, crc32c_init);
+    return ~crc32c_table_run(~crc, (const uint8_t *)data, len);
+}
@@ -48,7 +48,7 @@ void crypto_make_pipe_cache(nitro_tcp_socket_t *s, nitro_pipe_t *p) {
                 s->opt->pkey);
     assert(!r);
 
-    r = read(the_runtime->random_fd,
+    r = read(s->runtime->random_fd,
              p->nonce_gen, crypto_box_NONCEBYTES);
     assert(r == crypto_box_NONCEBYTES);
 
@@ -57,7 +57,7 @@ void crypto_make_pipe_cache(nitro_tcp_socket_t *s, nitro_pipe_t *p) {
 }
 
 void crypto_generate_nonce(nitro_pipe_t *p, uint8_t *ptr) {
-    NITRO_THREAD_CHECK;
+    NITRO_THREAD_CHECK(p->loop);
 
     (*p->nonce_incr)++;
 
@@ -75,6 +75,15 @@ nitro_frame_t *crypto_frame_encrypt(nitro_frame_t *fr, nitro_pipe_t *p) {
     bzero(ptr + crypto_box_NONCEBYTES, crypto_box_ZEROBYTES);
     nitro_buffer_extend(buf, crypto_box_ZEROBYTES + crypto_box_NONCEBYTES);
 
+    /* a file payload has to come into memory to be boxed */
+    void *file_data = fr->file ? nitro_frame_data(fr) : NULL;
+
+    if (fr->file && !file_data) {
+        nitro_buffer_destroy(buf);
+        nitro_frame_destroy(fr);
+        return NULL;
+    }
+
     int count;
 
     struct iovec *iovs = nitro_frame_iovs(fr, &count);
@@ -82,7 +91,9 @@ nitro_frame_t *crypto_frame_encrypt(nitro_frame_t *fr, nitro_pipe_t *p) {
     int i;
 
     for (i = 0; i < count; i++) {
-        nitro_buffer_append(buf, iovs[i].iov_base, iovs[i].iov_len);
+        /* (where iovs[1] holds its file offset) */
+        nitro_buffer_append(buf, file_data && i == 1 ? file_data : iovs[i].iov_base,
+                            iovs[i].iov_len);
     }
 
     nitro_frame_destroy(fr);
@@ -62,6 +62,10 @@ char *nitro_errmsg(NITRO_ERROR error) {
         return "socket queue operation would block";
         break;
 
+    case NITRO_ERR_TIMEOUT:
+        return "socket queue operation timed out";
+        break;
+
     case NITRO_ERR_NO_RECIPIENT:
         return "specified frame recipient not found in socket table";
         break;
@@ -84,6 +88,10 @@ char *nitro_errmsg(NITRO_ERROR error) {
         return "nitro is not running";
         break;
 
+    case NITRO_ERR_NOT_EMBEDDED:
+        return "nitro runtime was not started in embedded mode";
+        break;
+
     case NITRO_ERR_TCP_LOC_NOCOLON:
         return "TCP socket location did not contain a colon";
         break;
@@ -140,6 +148,18 @@ char *nitro_errmsg(NITRO_ERROR error) {
         return "(pipe) remote sent a SUB packet that is too short to be valid";
         break;
 
+    case NITRO_ERR_BAD_BATCH:
+        return "(pipe) remote sent a BATCH packet whose frames do not fit it";
+        break;
+
+    case NITRO_ERR_BAD_CHECKSUM:
+        return "(pipe) remote sent a frame that failed its checksum";
+        break;
+
+    case NITRO_ERR_BAD_COMPRESSED:
+        return "(pipe) remote sent a compressed frame that would not inflate";
+        break;
+
     case NITRO_ERR_BAD_HANDSHAKE:
         return "(pipe) remote sent a HELLO packet that is too short to be valid";
         break;
@@ -66,6 +66,11 @@
 #define NITRO_ERR_SUB_MISSING           26
 #define NITRO_ERR_TCP_BAD_ANY           27
 #define NITRO_ERR_GAI                   28
+#define NITRO_ERR_NOT_EMBEDDED          29
+#define NITRO_ERR_TIMEOUT               30
+#define NITRO_ERR_BAD_BATCH             31
+#define NITRO_ERR_BAD_COMPRESSED        32
+#define NITRO_ERR_BAD_CHECKSUM          33
 
 int nitro_set_error(NITRO_ERROR e);
 char *nitro_errmsg(NITRO_ERROR error);
@@ -34,16 +34,35 @@
  *
  */
 #include "frame.h"
+#include "buffer.h"
 #include "cbuffer.h"
+#include "crc32c.h"
 
 extern void nitro_frame_stack_pop(nitro_frame_t *f);
 extern void nitro_frame_stack_push_sender(nitro_frame_t *f);
 extern void *nitro_frame_data(nitro_frame_t *fr);
 extern uint32_t nitro_frame_size(nitro_frame_t *fr);
+extern int nitro_frame_priority(nitro_frame_t *fr);
+extern void nitro_frame_set_priority(nitro_frame_t *fr, int priority);
+extern double nitro_frame_deadline(nitro_frame_t *fr);
+extern void nitro_frame_set_deadline(nitro_frame_t *fr, double timeout);
+extern uint8_t nitro_frame_wire_flags(nitro_frame_t *fr);
+extern int nitro_frame_batchable(nitro_frame_t *fr);
+
+nitro_pool_t nitro_frame_pool = NITRO_POOL_INIT(nitro_frame_t, NITRO_POOL_FRAME);
+
+void nitro_frame_cleanup(nitro_frame_t *f) {
+    if (f->recv_shared) {
+        __sync_fetch_and_sub(&nitro_buffer_stat_referenced, f->size);
+    }
+
+    if (f->buffer) {
+        nitro_counted_buffer_decref(f->buffer);
+    }
 
-static inline void nitro_frame_cleanup(void *fp, void *unused) {
-    nitro_frame_t *f = (nitro_frame_t *)fp;
-    nitro_counted_buffer_decref(f->buffer);
+    if (f->flat) {
+        nitro_counted_buffer_decref(f->flat);
+    }
 
     if (f->ident_buffer) {
         nitro_counted_buffer_decref(f->ident_buffer);
@@ -53,7 +72,7 @@ static inline void nitro_frame_cleanup(void *fp, void *unused) {
         nitro_counted_buffer_decref(f->sender_buffer);
     }
 
-    free(f);
+    nitro_pool_free(&nitro_frame_pool, f);
 }
 
 void nitro_frame_set_iovec(nitro_frame_t *f, struct iovec *vecs) {
@@ -61,11 +80,38 @@ void nitro_frame_set_iovec(nitro_frame_t *f, struct iovec *vecs) {
     memcpy(f->iovs, vecs, sizeof(struct iovec) * f->iovec_set);
 }
 
+/* Point anything that aimed into frame `from` (the
+   header, inline data) at the same place in `to` */
+static inline void *nitro_frame_rebase(nitro_frame_t *from,
+                                       nitro_frame_t *to, void *p) {
+    char *c = (char *)p;
+
+    if (c >= (char *)from && c < (char *)(from + 1)) {
+        return (char *)to + (c - (char *)from);
+    }
+
+    return p;
+}
+
 nitro_frame_t *nitro_frame_copy_partial(nitro_frame_t *f, struct iovec *vecs) {
     assert(f->size < NITRO_MAX_FRAME);
-    nitro_frame_t *result = malloc(sizeof(nitro_frame_t));
-    memcpy(result, f, sizeof(nitro_frame_t));
-    nitro_counted_buffer_incref(f->buffer);
+    nitro_frame_t *result = nitro_pool_alloc(&nitro_frame_pool);
+    /* only as much of the inline area as is in use */
+    memcpy(result, f, offsetof(nitro_frame_t, inline_data));
+
+    if (f->buffer) {
+        nitro_counted_buffer_incref(f->buffer);
+    } else {
+        memcpy(result->inline_data, f->inline_data, f->size);
+    }
+
+    if (f->recv_shared) {
+        __sync_fetch_and_add(&nitro_buffer_stat_referenced, f->size);
+    }
+
+    if (result->flat) {
+        nitro_counted_buffer_incref(result->flat);
+    }
 
     if (f->ident_buffer) {
         nitro_counted_buffer_incref(f->ident_buffer);
@@ -75,12 +121,25 @@ nitro_frame_t *nitro_frame_copy_partial(nitro_frame_t *f, struct iovec *vecs) {
         nitro_counted_buffer_incref(f->sender_buffer);
     }
 
-    result->myref = nitro_counted_buffer_new(result, nitro_frame_cleanup, NULL);
+    result->refs = 1;
 
     if (vecs) {
         nitro_frame_set_iovec(result, vecs);
     }
 
+    int i;
+    result->data = nitro_frame_rebase(f, result, result->data);
+
+    for (i = 0; i < result->iovec_set; i++) {
+        /* a file payload's "base" is a file offset */
+        if (f->file && i == 1) {
+            continue;
+        }
+
+        result->iovs[i].iov_base = nitro_frame_rebase(f, result,
+                                   result->iovs[i].iov_base);
+    }
+
     return result;
 }
 
@@ -92,12 +151,13 @@ nitro_frame_t *nitro_frame_new(void *data, uint32_t size, nitro_free_function ff
 nitro_frame_t *nitro_frame_new_prealloc(void *data, uint32_t size, nitro_counted_buffer_t *buffer) {
     assert(size < NITRO_MAX_FRAME);
     nitro_frame_t *f;
-    f = malloc(sizeof(nitro_frame_t));
+    f = nitro_pool_alloc(&nitro_frame_pool);
     bzero(f, FRAME_BZERO_SIZE);
     f->buffer = buffer;
     f->size = size;
     f->data = data;
-    f->myref = nitro_counted_buffer_new(f, nitro_frame_cleanup, NULL);
+    f->deadline = 0;
+    f->refs = 1;
     return f;
 }
 
@@ -155,7 +215,196 @@ void nitro_frame_set_sender(nitro_frame_t *f,
     }
 }
 
+/* Backing for a segmented frame; shared by its copies */
+typedef struct nitro_frame_segs_t {
+    nitro_free_function ff;
+    void *baton;
+    int count;
+    struct iovec vecs[];
+} nitro_frame_segs_t;
+
+static void nitro_frame_free_segs(void *p, void *unused) {
+    nitro_frame_segs_t *s = (nitro_frame_segs_t *)p;
+    int i;
+
+    if (s->ff) {
+        for (i = 0; i < s->count; i++) {
+            s->ff(s->vecs[i].iov_base, s->baton);
+        }
+    }
+
+    free(s);
+}
+
+nitro_frame_t *nitro_frame_new_iov(struct iovec *vecs, int count,
+                                   nitro_free_function ff, void *baton) {
+    assert(count > 0 && count <= NITRO_FRAME_MAX_SEGS);
+    nitro_frame_segs_t *s = malloc(sizeof(nitro_frame_segs_t) +
+                                   count * sizeof(struct iovec));
+    s->ff = ff;
+    s->baton = baton;
+    s->count = count;
+    memcpy(s->vecs, vecs, count * sizeof(struct iovec));
+
+    uint32_t size = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        size += vecs[i].iov_len;
+    }
+
+    nitro_frame_t *f = nitro_frame_new_prealloc(NULL, size,
+                       nitro_counted_buffer_new(s, nitro_frame_free_segs, NULL));
+    f->segs = s->vecs;
+    f->num_segs = count;
+    return f;
+}
+
+static void nitro_frame_free_file(void *p, void *unused) {
+    nitro_frame_file_t *file = (nitro_frame_file_t *)p;
+    close(file->fd);
+    free(file);
+}
+
+nitro_frame_t *nitro_frame_new_file(int fd, off_t offset, uint32_t size) {
+    nitro_frame_file_t *file;
+    ZALLOC(file);
+    file->fd = fd;
+    file->offset = offset;
+
+    nitro_frame_t *f = nitro_frame_new_prealloc(NULL, size,
+                       nitro_counted_buffer_new(file, nitro_frame_free_file, NULL));
+    f->file = file;
+    return f;
+}
+
+int nitro_frame_segments(nitro_frame_t *fr, struct iovec *out, int max) {
+    if (!fr->segs) {
+        if (max > 0) {
+            out[0].iov_base = nitro_frame_data(fr);
+            out[0].iov_len = fr->size;
+        }
+
+        return 1;
+    }
+
+    memcpy(out, fr->segs,
+           (fr->num_segs < max ? fr->num_segs : max) * sizeof(struct iovec));
+    return fr->num_segs;
+}
+
+/* Join the segments (or read the file) into one region,
+   kept alongside them in `flat`.  The frame may be queued
+   (NITRO_REUSE), and another thread writing it out, so
+   nothing it sends from is touched; if two threads join
+   it at once, the first copy stored wins.  NULL if there
+   is nothing to join or the file could not be read */
+void *nitro_frame_flatten(nitro_frame_t *fr) {
+    nitro_counted_buffer_t *flat = __atomic_load_n(&fr->flat, __ATOMIC_ACQUIRE);
+
+    if (flat) {
+        return flat->ptr;
+    }
+
+    if (!fr->segs && !fr->file) {
+        return NULL;
+    }
+
+    char *ptr = malloc(fr->size ? fr->size : 1);
+    int i;
+    uint32_t off = 0;
+
+    for (i = 0; i < fr->num_segs; i++) {
+        memcpy(ptr + off, fr->segs[i].iov_base, fr->segs[i].iov_len);
+        off += fr->segs[i].iov_len;
+    }
+
+    if (fr->file) {
+        while (off < fr->size) {
+            ssize_t r = pread(fr->file->fd, ptr + off, fr->size - off,
+                              fr->file->offset + off);
+
+            if (r <= 0) {
+                free(ptr);
+                return NULL;
+            }
+
+            off += r;
+        }
+    }
+
+    flat = nitro_counted_buffer_new(ptr, just_free, NULL);
+    nitro_counted_buffer_t *none = NULL;
+
+    if (!__atomic_compare_exchange_n(&fr->flat, &none, flat, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        nitro_counted_buffer_decref(flat);
+        flat = none;
+    }
+
+    return flat->ptr;
+}
+
+/* Pack batchable frames into one BATCH frame (the
+   frames themselves are left alone) */
+nitro_frame_t *nitro_frame_batch(nitro_frame_t **frames, int count) {
+    uint32_t size = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        nitro_frame_t *fr = frames[i];
+        size += sizeof(nitro_batch_header) + fr->size +
+                (fr->num_ident + (fr->push_sender ? 1 : 0)) * SOCKET_IDENT_LENGTH;
+    }
+
+    nitro_frame_t *b;
+    char *ptr;
+
+    if (size <= NITRO_FRAME_INLINE) {
+        b = nitro_frame_new_prealloc(NULL, size, NULL);
+        ptr = b->data = b->inline_data;
+    } else {
+        ptr = malloc(size);
+        b = nitro_frame_new_heap(ptr, size);
+    }
+
+    b->type = NITRO_FRAME_BATCH;
+
+    for (i = 0; i < count; i++) {
+        nitro_frame_t *fr = frames[i];
+        /* the packet as a whole carries any checksum */
+        nitro_batch_header hd = {fr->size,
+                                 fr->num_ident + (fr->push_sender ? 1 : 0),
+                                 nitro_frame_wire_flags(fr) & ~NITRO_FRAME_CHECKSUM
+                                };
+        b->checksum |= fr->checksum;
+        memcpy(ptr, &hd, sizeof(hd));
+        ptr += sizeof(hd);
+        memcpy(ptr, fr->data, fr->size);
+        ptr += fr->size;
+
+        if (fr->num_ident) {
+            memcpy(ptr, fr->ident_data, fr->num_ident * SOCKET_IDENT_LENGTH);
+            ptr += fr->num_ident * SOCKET_IDENT_LENGTH;
+        }
+
+        if (fr->push_sender) {
+            memcpy(ptr, fr->sender, SOCKET_IDENT_LENGTH);
+            ptr += SOCKET_IDENT_LENGTH;
+        }
+    }
+
+    return b;
+}
+
 nitro_frame_t *nitro_frame_new_copy(void *data, uint32_t size) {
+    if (size <= NITRO_FRAME_INLINE) {
+        nitro_frame_t *f = nitro_frame_new_prealloc(NULL, size, NULL);
+        memcpy(f->inline_data, data, size);
+        f->data = f->inline_data;
+        return f;
+    }
+
     char *n = malloc(size);
     memmove(n, data, size);
     return nitro_frame_new(n, size, just_free, NULL);
@@ -173,36 +422,57 @@ struct iovec *nitro_frame_iovs(nitro_frame_t *fr, int *num) {
 
     fr->tcp_header.num_ident = fr->push_sender ?
                                fr->num_ident + 1 : fr->num_ident;
-    fr->tcp_header.flags = 0;
+    fr->tcp_header.flags = nitro_frame_wire_flags(fr);
     fr->tcp_header.frame_size = fr->size;
 
     fr->iovs[0].iov_base = (void *)&fr->tcp_header;
     fr->iovs[0].iov_len = sizeof(nitro_protocol_header);
-    fr->iovs[1].iov_base = nitro_frame_data(fr);
-    fr->iovs[1].iov_len = fr->size;
+    int n = 1;
+
+    if (fr->file) {
+        /* the queue sends this one straight from the file */
+        fr->iovs[1].iov_base = (void *)(uintptr_t)fr->file->offset;
+        fr->iovs[1].iov_len = fr->size;
+        ++n;
+    } else if (fr->segs) {
+        /* segments go out as they are, no joining */
+        memcpy(&fr->iovs[1], fr->segs, fr->num_segs * sizeof(struct iovec));
+        n += fr->num_segs;
+    } else {
+        fr->iovs[1].iov_base = fr->data;
+        fr->iovs[1].iov_len = fr->size;
+        ++n;
+    }
 
     if (fr->num_ident) {
-        fr->iovs[2].iov_base = fr->ident_data;
-        fr->iovs[2].iov_len = fr->num_ident * SOCKET_IDENT_LENGTH;
+        fr->iovs[n].iov_base = fr->ident_data;
+        fr->iovs[n].iov_len = fr->num_ident * SOCKET_IDENT_LENGTH;
+        ++n;
+    }
 
-        if (fr->push_sender) {
-            fr->iovs[3].iov_base = fr->sender;
-            fr->iovs[3].iov_len = SOCKET_IDENT_LENGTH;
-            fr->iovec_set = 4;
-        } else {
-            fr->iovec_set = 3;
-            fr->iovs[3].iov_len = 0;
+    if (fr->push_sender) {
+        fr->iovs[n].iov_base = fr->sender;
+        fr->iovs[n].iov_len = SOCKET_IDENT_LENGTH;
+        ++n;
+    }
+
+    if (fr->checksum) {
+        /* the trailer covers everything before it */
+        uint32_t crc = 0;
+        int i;
+
+        for (i = 0; i < n; i++) {
+            crc = crc32c(crc, fr->iovs[i].iov_base, fr->iovs[i].iov_len);
         }
-    } else if (fr->push_sender) {
-        fr->iovs[2].iov_base = fr->sender;
-        fr->iovs[2].iov_len = SOCKET_IDENT_LENGTH;
-        fr->iovec_set = 3;
-        fr->iovs[3].iov_len = 0;
-    } else {
-        fr->iovec_set = 2;
-        fr->iovs[2].iov_len = fr->iovs[3].iov_len = 0;
+
+        fr->tcp_checksum = crc;
+        fr->iovs[n].iov_base = (void *)&fr->tcp_checksum;
+        fr->iovs[n].iov_len = sizeof(uint32_t);
+        ++n;
     }
 
+    fr->iovec_set = n;
+
     *num = fr->iovec_set;
 
     return (struct iovec *)fr->iovs;
@@ -263,7 +533,10 @@ void nitro_key_destroy(nitro_key_t *k) {
 }
 
 void nitro_frame_clear(nitro_frame_t *fr) {
-    nitro_counted_buffer_decref(fr->buffer);
+    if (fr->buffer) {
+        nitro_counted_buffer_decref(fr->buffer);
+    }
+
     fr->data = NULL;
     fr->size = 0;
     fr->buffer = nitro_counted_buffer_new(NULL, free_nothing, NULL);
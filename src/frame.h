@@ -45,9 +45,35 @@
 #define NITRO_FRAME_SUB  1
 #define NITRO_FRAME_HELLO 2
 #define NITRO_FRAME_SECURE 3
+#define NITRO_FRAME_BATCH 4
 
 #define NITRO_MAX_FRAME (1024 * 1024 * 1024)
 
+/* Payloads this small are copied into the frame itself
+   rather than given their own buffer */
+#define NITRO_FRAME_INLINE 128
+
+/* Segments in a scatter/gather frame; on the wire it
+   takes header + segments + idents + sender + checksum
+   iovecs */
+#define NITRO_FRAME_MAX_SEGS 8
+#define NITRO_FRAME_MAX_IOV (NITRO_FRAME_MAX_SEGS + 4)
+
+/* Small data frames packed behind one header when several
+   are ready to write at once */
+#define NITRO_FRAME_BATCH_MAX 64
+
+/* Frame priorities; higher is more urgent.  Carried in
+   the low bits of the protocol header `flags` */
+#define NITRO_PRIORITY_LEVELS 4
+#define NITRO_PRIORITY_MAX (NITRO_PRIORITY_LEVELS - 1)
+#define NITRO_FRAME_PRIORITY_MASK 0x03
+/* High bit of `flags`: the payload is deflated */
+#define NITRO_FRAME_COMPRESSED 0x80
+/* The packet is followed by a CRC32C of it (header, data
+   and idents) */
+#define NITRO_FRAME_CHECKSUM 0x40
+
 /* Used for publishing */
 typedef struct nitro_key_t {
     const uint8_t *data;
@@ -58,6 +84,13 @@ typedef struct nitro_key_t {
     struct nitro_key_t *next;
 } nitro_key_t;
 
+/* Payload of a file-backed frame; iovs[1] of such a frame
+   holds the file offset (as iov_base) and length to send */
+typedef struct nitro_frame_file_t {
+    int fd;
+    off_t offset;
+} nitro_frame_file_t;
+
 typedef struct nitro_protocol_header {
     char protocol_version;
     char packet_type;
@@ -66,9 +99,16 @@ typedef struct nitro_protocol_header {
     uint32_t frame_size;
 } nitro_protocol_header;
 
+/* Each frame in a BATCH packet: this, data, then idents */
+typedef struct nitro_batch_header {
+    uint16_t frame_size;
+    uint8_t num_ident;
+    uint8_t flags;
+} nitro_batch_header;
+
 #define FRAME_BZERO_SIZE \
-    ((sizeof(void *) * 3) + \
-     (sizeof(char) * 4))
+    ((sizeof(void *) * 6) + \
+     (sizeof(char) * 9))
 
 typedef struct nitro_frame_t {
     /* NOTE: careful about order here!
@@ -81,25 +121,49 @@ typedef struct nitro_frame_t {
     nitro_counted_buffer_t *ident_buffer;
     nitro_counted_buffer_t *sender_buffer;
     void *ident_data;
+    /* segments, if built by nitro_frame_new_iov */
+    struct iovec *segs;
+    /* payload file, if built by nitro_frame_new_file */
+    struct nitro_frame_file_t *file;
+    /* the segments or file joined into one region, once
+       nitro_frame_data has asked for it */
+    nitro_counted_buffer_t *flat;
 
     uint8_t num_ident;
     char iovec_set;
     char type;
     /* send self ident? */
     char push_sender;
+    uint8_t priority;
+    uint8_t num_segs;
+    /* data is deflated (see compress.h) */
+    char compressed;
+    /* send a CRC32C trailer */
+    char checksum;
+    /* data points into a receive buffer (counted in
+       nitro_buffer_stat_referenced) */
+    char recv_shared;
 
     /* END bzero() region */
 
+    /* NULL when data is inline */
     nitro_counted_buffer_t *buffer;
     void *data;
     uint32_t size;
+    /* now_double() time after which the frame is dropped
+       instead of delivered; 0 = never */
+    double deadline;
 
     uint8_t *sender;
-    nitro_counted_buffer_t *myref;
+    /* references to this frame; freed when it drops to 0 */
+    int refs;
 
     // TCP
     nitro_protocol_header tcp_header;
-    struct iovec iovs[4];
+    uint32_t tcp_checksum;
+    struct iovec iovs[NITRO_FRAME_MAX_IOV];
+
+    char inline_data[NITRO_FRAME_INLINE];
 
 } nitro_frame_t;
 
@@ -108,6 +172,12 @@ nitro_frame_t *nitro_frame_copy_partial(nitro_frame_t *f, struct iovec *vecs);
 nitro_frame_t *nitro_frame_new(void *data, uint32_t size, nitro_free_function ff, void *baton);
 nitro_frame_t *nitro_frame_new_prealloc(void *data, uint32_t size, nitro_counted_buffer_t *buffer);
 nitro_frame_t *nitro_frame_new_copy(void *data, uint32_t size);
+nitro_frame_t *nitro_frame_new_iov(struct iovec *vecs, int count,
+                                   nitro_free_function ff, void *baton);
+int nitro_frame_segments(nitro_frame_t *fr, struct iovec *out, int max);
+nitro_frame_t *nitro_frame_new_file(int fd, off_t offset, uint32_t size);
+nitro_frame_t *nitro_frame_batch(nitro_frame_t **frames, int count);
+void *nitro_frame_flatten(nitro_frame_t *fr);
 void nitro_frame_clear(nitro_frame_t *fr);
 #define nitro_frame_new_heap(d, size) nitro_frame_new(d, size, just_free, NULL)
 
@@ -122,14 +192,22 @@ void nitro_frame_set_stack(nitro_frame_t *f, const uint8_t *data,
                            nitro_counted_buffer_t *buf, uint8_t num);
 void nitro_frame_extend_stack(nitro_frame_t *fr, nitro_frame_t *to);
 
+void nitro_frame_cleanup(nitro_frame_t *f);
+
 #define nitro_frame_destroy(f) {\
-        nitro_counted_buffer_decref((f)->myref);\
+        nitro_frame_t *__tmp_fr = (f);\
+        if (__sync_fetch_and_sub(&__tmp_fr->refs, 1) == 1) {\
+            nitro_frame_cleanup(__tmp_fr);\
+        }\
     }
 
 #define nitro_frame_incref(f) {\
-        nitro_counted_buffer_incref((f)->myref);\
+        nitro_frame_t *__tmp_fr = (f);\
+        __sync_fetch_and_add(&__tmp_fr->refs, 1);\
     }
 
+extern nitro_pool_t nitro_frame_pool;
+
 nitro_key_t *nitro_key_new(const uint8_t *data, uint8_t length,
                            nitro_counted_buffer_t *buf);
 int nitro_key_compare(nitro_key_t *k1, nitro_key_t *k2);
@@ -146,11 +224,45 @@ inline void nitro_frame_stack_push_sender(nitro_frame_t *f) {
 }
 
 inline void *nitro_frame_data(nitro_frame_t *fr) {
-    return fr->data;
+    /* segmented and file-backed frames have no data until asked */
+    return fr->data ? fr->data : nitro_frame_flatten(fr);
 }
 
 inline uint32_t nitro_frame_size(nitro_frame_t *fr) {
     return fr->size;
 }
 
+inline double nitro_frame_deadline(nitro_frame_t *fr) {
+    return fr->deadline;
+}
+
+inline void nitro_frame_set_deadline(nitro_frame_t *fr, double timeout) {
+    fr->deadline = timeout > 0 ? now_double() + timeout : 0;
+}
+
+/* protocol header `flags`: priority, whether compressed,
+   and whether checksummed */
+inline uint8_t nitro_frame_wire_flags(nitro_frame_t *fr) {
+    return (fr->priority & NITRO_FRAME_PRIORITY_MASK) |
+           (fr->compressed ? NITRO_FRAME_COMPRESSED : 0) |
+           (fr->checksum ? NITRO_FRAME_CHECKSUM : 0);
+}
+
+/* small enough, and plain enough, to go in a BATCH packet */
+inline int nitro_frame_batchable(nitro_frame_t *fr) {
+    return fr->type == NITRO_FRAME_DATA && fr->size <= NITRO_FRAME_INLINE &&
+           !fr->segs && !fr->file;
+}
+
+inline int nitro_frame_priority(nitro_frame_t *fr) {
+    return fr->priority;
+}
+
+inline void nitro_frame_set_priority(nitro_frame_t *fr, int priority) {
+    fr->priority = priority < 0 ? 0 :
+                   priority > NITRO_PRIORITY_MAX ? NITRO_PRIORITY_MAX : priority;
+    /* header is stale */
+    fr->iovec_set = 0;
+}
+
 #endif /* FRAME_H */
@@ -33,11 +33,21 @@
  *
  */
 #include "socket.h"
+#include "runtime.h"
 #include "Stcp.h"
 #include "Sinproc.h"
 
 nitro_socket_t *nitro_socket_bind(char *location, nitro_sockopt_t *opt) {
-    nitro_socket_t *s = nitro_socket_new(opt);
+    return nitro_runtime_socket_bind(the_runtime, location, opt);
+}
+
+nitro_socket_t *nitro_socket_connect(char *location, nitro_sockopt_t *opt) {
+    return nitro_runtime_socket_connect(the_runtime, location, opt);
+}
+
+nitro_socket_t *nitro_runtime_socket_bind(nitro_runtime_t *rt,
+        char *location, nitro_sockopt_t *opt) {
+    nitro_socket_t *s = nitro_socket_new(rt, opt);
 
     if (!s) {
         return NULL;
@@ -64,8 +74,9 @@ nitro_socket_t *nitro_socket_bind(char *location, nitro_sockopt_t *opt) {
     return s;
 }
 
-nitro_socket_t *nitro_socket_connect(char *location, nitro_sockopt_t *opt) {
-    nitro_socket_t *s = nitro_socket_new(opt);
+nitro_socket_t *nitro_runtime_socket_connect(nitro_runtime_t *rt,
+        char *location, nitro_sockopt_t *opt) {
+    nitro_socket_t *s = nitro_socket_new(rt, opt);
 
     if (!s) {
         return NULL;
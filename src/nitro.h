@@ -48,7 +48,11 @@
 #define NITRO_NOWAIT (1 << 1)
 
 #define nitro_send(fr, s, flags) SOCKET_CALL(s, send, fr, flags)
+#define nitro_send_many(frames, n, s, flags) SOCKET_CALL(s, send_many, frames, n, flags)
 #define nitro_recv(s, flags) SOCKET_CALL(s, recv, flags)
+#define nitro_send_timeout(fr, s, timeout, flags) SOCKET_CALL(s, send_timeout, fr, timeout, flags)
+#define nitro_recv_timeout(s, timeout) SOCKET_CALL(s, recv_timeout, timeout)
+#define nitro_recv_many(s, frames, max, flags) SOCKET_CALL(s, recv_many, frames, max, flags)
 #define nitro_reply(snd, fr, s, flags) SOCKET_CALL(s, reply, snd, fr, flags)
 #define nitro_relay_fw(snd, fr, s, flags) SOCKET_CALL(s, relay_fw, snd, fr, flags)
 #define nitro_relay_bk(snd, fr, s, flags) SOCKET_CALL(s, relay_bk, snd, fr, flags)
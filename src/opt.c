@@ -63,6 +63,15 @@ void nitro_sockopt_set_want_eventfd(nitro_sockopt_t *opt, int want_eventfd) {
     opt->want_eventfd = want_eventfd;
 }
 
+void nitro_sockopt_set_ring_queues(nitro_sockopt_t *opt, int enabled) {
+    opt->ring_queues = enabled;
+}
+
+void nitro_sockopt_set_spill(nitro_sockopt_t *opt, const char *dir) {
+    free(opt->spill_dir);
+    opt->spill_dir = dir ? strdup(dir) : NULL;
+}
+
 void nitro_sockopt_set_hwm_detail(nitro_sockopt_t *opt, int hwm_in,
                                   int hwm_out_general, int hwm_out_private) {
     opt->hwm_in = hwm_in;
@@ -70,6 +79,18 @@ void nitro_sockopt_set_hwm_detail(nitro_sockopt_t *opt, int hwm_in,
     opt->hwm_out_private = hwm_out_private;
 }
 
+void nitro_sockopt_set_hwm_bytes(nitro_sockopt_t *opt, size_t hwm_bytes) {
+    opt->hwm_bytes_in = opt->hwm_bytes_out_general =
+                            opt->hwm_bytes_out_private = hwm_bytes;
+}
+
+void nitro_sockopt_set_hwm_bytes_detail(nitro_sockopt_t *opt, size_t hwm_bytes_in,
+                                        size_t hwm_bytes_out_general, size_t hwm_bytes_out_private) {
+    opt->hwm_bytes_in = hwm_bytes_in;
+    opt->hwm_bytes_out_general = hwm_bytes_out_general;
+    opt->hwm_bytes_out_private = hwm_bytes_out_private;
+}
+
 void nitro_sockopt_set_close_linger(nitro_sockopt_t *opt,
                                     double close_linger) {
     opt->close_linger = close_linger;
@@ -93,6 +114,18 @@ void nitro_sockopt_set_max_message_size(nitro_sockopt_t *opt,
     opt->max_message_size = max_message_size;
 }
 
+void nitro_sockopt_set_compress(nitro_sockopt_t *opt, uint32_t threshold) {
+    opt->compress_threshold = threshold;
+}
+
+void nitro_sockopt_set_checksum(nitro_sockopt_t *opt, int enabled) {
+    opt->checksum = enabled;
+}
+
+void nitro_sockopt_set_copy_below(nitro_sockopt_t *opt, uint32_t size) {
+    opt->copy_below = size;
+}
+
 void nitro_sockopt_set_secure_identity(nitro_sockopt_t *opt,
                                        uint8_t *ident, size_t ident_length,
                                        uint8_t *pkey, size_t pkey_length) {
@@ -135,6 +168,7 @@ void nitro_sockopt_disable_error_handler(nitro_sockopt_t *opt) {
 
 void nitro_sockopt_destroy(nitro_sockopt_t *opt) {
     nitro_counted_buffer_decref(opt->ident_buf);
+    free(opt->spill_dir);
     free(opt);
 }
 
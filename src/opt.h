@@ -44,10 +44,23 @@ typedef struct nitro_sockopt_t {
     int hwm_in;
     int hwm_out_general;
     int hwm_out_private;
+    size_t hwm_bytes_in;
+    size_t hwm_bytes_out_general;
+    size_t hwm_bytes_out_private;
     double close_linger;
     double reconnect_interval;
     uint32_t max_message_size;
+    /* deflate TCP frames bigger than this; 0 = never */
+    uint32_t compress_threshold;
+    /* CRC32C trailer on outgoing TCP frames */
+    int checksum;
+    /* copy received frames smaller than this, rather than
+       keep the receive buffer alive for them */
+    uint32_t copy_below;
     int want_eventfd;
+    int ring_queues;
+    /* directory for send queue overflow files, or NULL */
+    char *spill_dir;
 
     int has_ident;
     uint8_t *ident;
@@ -68,12 +81,18 @@ nitro_sockopt_t *nitro_sockopt_new();
 void nitro_sockopt_set_hwm(nitro_sockopt_t *opt, int hwm);
 void nitro_sockopt_set_hwm_detail(nitro_sockopt_t *opt, int hwm_in,
                                   int hwm_out_general, int hwm_out_private);
+void nitro_sockopt_set_hwm_bytes(nitro_sockopt_t *opt, size_t hwm_bytes);
+void nitro_sockopt_set_hwm_bytes_detail(nitro_sockopt_t *opt, size_t hwm_bytes_in,
+                                        size_t hwm_bytes_out_general, size_t hwm_bytes_out_private);
 void nitro_sockopt_set_close_linger(nitro_sockopt_t *opt,
                                     double close_linger);
 void nitro_sockopt_set_reconnect_interval(nitro_sockopt_t *opt,
         double reconnect_interval);
 void nitro_sockopt_set_max_message_size(nitro_sockopt_t *opt,
                                         uint32_t max_message_size);
+void nitro_sockopt_set_compress(nitro_sockopt_t *opt, uint32_t threshold);
+void nitro_sockopt_set_checksum(nitro_sockopt_t *opt, int enabled);
+void nitro_sockopt_set_copy_below(nitro_sockopt_t *opt, uint32_t size);
 void nitro_sockopt_set_secure_identity(nitro_sockopt_t *opt,
                                        uint8_t *ident, size_t ident_length,
                                        uint8_t *pkey, size_t pkey_length);
@@ -81,6 +100,8 @@ void nitro_sockopt_set_secure(nitro_sockopt_t *opt, int enabled);
 void nitro_sockopt_set_required_remote_ident(nitro_sockopt_t *opt,
         uint8_t *ident, size_t ident_length);
 void nitro_sockopt_set_want_eventfd(nitro_sockopt_t *opt, int want_eventfd);
+void nitro_sockopt_set_ring_queues(nitro_sockopt_t *opt, int enabled);
+void nitro_sockopt_set_spill(nitro_sockopt_t *opt, const char *dir);
 void nitro_sockopt_set_tcp_keep_alive(nitro_sockopt_t *opt, int alive_time);
 void nitro_sockopt_set_error_handler(nitro_sockopt_t *opt,
                                      nitro_error_handler handler, void *baton);
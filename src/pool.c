@@ -0,0 +1,191 @@
+/*
+ * Nitro
+ *
+ * pool.c - Per-thread free lists for the small, fixed-size objects
+ *          every message allocates (frames, counted buffers)
+ *
+ *  -- LICENSE --
+ *
+ * Copyright 2013 Bump Technologies, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BUMP TECHNOLOGIES, INC. ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP TECHNOLOGIES, INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of Bump Technologies, Inc.
+ *
+ */
+
+#include "pool.h"
+
+/*
+ * Each thread allocates from, and frees into, its own
+ * cache, so steady-state messaging never takes a lock or
+ * calls malloc.  Frames are often freed on a different
+ * thread (the I/O thread, after a write) than the one
+ * that made them, so a cache that grows past
+ * NITRO_POOL_CACHE_MAX hands half back to the pool's
+ * shared stack, and a thread whose cache runs dry takes
+ * that whole stack.  Pushes are a CAS and the take is an
+ * exchange, so the stack has no ABA problem.  Only when
+ * both are empty do we malloc, a slab at a time.
+ *
+ * Slabs are never returned to the system; a pool holds on
+ * to its high-water mark of live objects.  Build with
+ * NITRO_POOL_DISABLE to use malloc/free directly (e.g.,
+ * under valgrind).
+ */
+
+#ifdef NITRO_POOL_DISABLE
+
+void *nitro_pool_alloc(nitro_pool_t *p) {
+    return malloc(p->size);
+}
+
+void nitro_pool_free(nitro_pool_t *p, void *obj) {
+    free(obj);
+}
+
+#else
+
+#define NEXT(o) (*(void **)(o))
+
+typedef struct nitro_pool_cache {
+    void *head;
+    /* a lower bound; what is taken from the shared stack
+       isn't counted, so refills never walk a cold list */
+    int count;
+} nitro_pool_cache;
+
+static __thread nitro_pool_cache nitro_pool_caches[NITRO_POOL_COUNT];
+static __thread int nitro_pool_thread_registered;
+static nitro_pool_t *nitro_pools[NITRO_POOL_COUNT];
+static pthread_once_t nitro_pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t nitro_pool_key;
+
+static void nitro_pool_push_shared(nitro_pool_t *p, void *first, void *last) {
+    void *head = __atomic_load_n(&p->shared, __ATOMIC_RELAXED);
+
+    do {
+        NEXT(last) = head;
+    } while (!__atomic_compare_exchange_n(&p->shared, &head, first, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* a thread's cache outlives it on the shared stack */
+static void nitro_pool_thread_exit(void *unused) {
+    int i;
+
+    for (i = 0; i < NITRO_POOL_COUNT; i++) {
+        nitro_pool_cache *c = &nitro_pool_caches[i];
+
+        if (!c->head) {
+            continue;
+        }
+
+        void *last = c->head;
+
+        while (NEXT(last)) {
+            last = NEXT(last);
+        }
+
+        nitro_pool_push_shared(nitro_pools[i], c->head, last);
+        c->head = NULL;
+        c->count = 0;
+    }
+}
+
+static void nitro_pool_key_init() {
+    pthread_key_create(&nitro_pool_key, nitro_pool_thread_exit);
+}
+
+/* so the thread's cache is handed back when it exits */
+static void nitro_pool_register_thread() {
+    if (!nitro_pool_thread_registered) {
+        pthread_once(&nitro_pool_once, nitro_pool_key_init);
+        /* any non-NULL value, so the destructor runs */
+        pthread_setspecific(nitro_pool_key, nitro_pools);
+        nitro_pool_thread_registered = 1;
+    }
+}
+
+static void nitro_pool_refill(nitro_pool_t *p, nitro_pool_cache *c) {
+    nitro_pools[p->id] = p;
+    nitro_pool_register_thread();
+
+    void *o = __atomic_exchange_n(&p->shared, NULL, __ATOMIC_ACQUIRE);
+
+    if (o) {
+        c->head = o;
+        return;
+    }
+
+    char *slab = malloc(p->size * p->slab);
+    int i;
+
+    for (i = 0; i < p->slab - 1; i++) {
+        NEXT(slab + i * p->size) = slab + (i + 1) * p->size;
+    }
+
+    NEXT(slab + i * p->size) = NULL;
+    c->head = slab;
+    c->count = p->slab;
+    __sync_fetch_and_add(&p->stat_slabs, 1);
+}
+
+void *nitro_pool_alloc(nitro_pool_t *p) {
+    nitro_pool_cache *c = &nitro_pool_caches[p->id];
+
+    if (!c->head) {
+        nitro_pool_refill(p, c);
+    }
+
+    void *o = c->head;
+    c->head = NEXT(o);
+
+    if (c->count) {
+        c->count--;
+    }
+
+    return o;
+}
+
+void nitro_pool_free(nitro_pool_t *p, void *obj) {
+    nitro_pool_register_thread();
+    nitro_pool_cache *c = &nitro_pool_caches[p->id];
+    NEXT(obj) = c->head;
+    c->head = obj;
+
+    if (++c->count > p->cache_max) {
+        int i;
+        void *first = c->head, *last = first;
+
+        for (i = 1; i < p->cache_max / 2; i++) {
+            last = NEXT(last);
+        }
+
+        c->head = NEXT(last);
+        c->count -= p->cache_max / 2;
+        nitro_pool_push_shared(p, first, last);
+    }
+}
+
+#endif /* NITRO_POOL_DISABLE */
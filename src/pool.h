@@ -0,0 +1,75 @@
+/*
+ * Nitro
+ *
+ * pool.h - Per-thread free lists for the small, fixed-size objects
+ *          every message allocates (frames, counted buffers)
+ *
+ *  -- LICENSE --
+ *
+ * Copyright 2013 Bump Technologies, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BUMP TECHNOLOGIES, INC. ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP TECHNOLOGIES, INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of Bump Technologies, Inc.
+ *
+ */
+
+#ifndef NITRO_POOL_H
+#define NITRO_POOL_H
+#include "common.h"
+
+/* Objects carved from each malloc when a pool runs dry */
+#define NITRO_POOL_SLAB 64
+/* Free objects a thread keeps before handing half back */
+#define NITRO_POOL_CACHE_MAX 256
+
+enum {
+    NITRO_POOL_FRAME,
+    NITRO_POOL_CBUFFER,
+    NITRO_POOL_SEGMENT,
+    NITRO_POOL_COUNT
+};
+
+typedef struct nitro_pool_t {
+    size_t size;
+    int id;
+    /* NITRO_POOL_SLAB and NITRO_POOL_CACHE_MAX, unless the
+       objects are big enough to want fewer */
+    int slab;
+    int cache_max;
+    /* free objects handed back by threads (lock-free stack) */
+    void *shared;
+    /* slabs malloc'd so far */
+    uint64_t stat_slabs;
+} nitro_pool_t;
+
+#define NITRO_POOL_INIT(type, id) \
+    NITRO_POOL_INIT_SIZED(sizeof(type) > sizeof(void *) ? sizeof(type) : sizeof(void *), \
+                          id, NITRO_POOL_SLAB, NITRO_POOL_CACHE_MAX)
+#define NITRO_POOL_INIT_SIZED(size, id, slab, cache_max) \
+    {size, id, slab, cache_max, NULL, 0}
+
+void *nitro_pool_alloc(nitro_pool_t *p);
+void nitro_pool_free(nitro_pool_t *p, void *obj);
+
+#endif /* NITRO_POOL_H */
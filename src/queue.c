@@ -40,13 +40,48 @@
 #include "queue.h"
 #include "buffer.h"
 
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
 extern inline int nitro_queue_count(nitro_queue_t *q);
+extern inline size_t nitro_queue_bytes(nitro_queue_t *q);
+
+/* Timed waits measure against the monotonic clock where
+   condvars can be told to use it, so deadlines don't move
+   with the wall clock */
+#if defined(CLOCK_MONOTONIC) && !defined(__APPLE__)
+#define NITRO_QUEUE_CLOCK CLOCK_MONOTONIC
+#define NITRO_QUEUE_CONDATTR_CLOCK
+#else
+#define NITRO_QUEUE_CLOCK CLOCK_REALTIME
+#endif
 
 #define NITRO_MAX_IOV IOV_MAX
 #define QUEUE_FD_BUFFER_GUESS (32 * 1024)
 #define QUEUE_FD_BUFFER_PADDING (2 * 1024)
+/* file-backed frames per gathered write */
+#define QUEUE_FD_MAX_FILES 8
+
+static void nitro_queue_issue_callbacks(nitro_queue_t *q,
+                                        NITRO_QUEUE_STATE old_state);
+
+/* full once either limit is reached; so a byte limit can be
+   overshot by (at most) the one frame that reached it */
+int nitro_queue_full(nitro_queue_t *q) {
+    if (q->ring) {
+        return __atomic_load_n(&q->count, __ATOMIC_ACQUIRE) >= q->capacity;
+    }
+
+    return (q->capacity && q->count >= q->capacity) ||
+           (q->byte_capacity && q->bytes >= q->byte_capacity);
+}
 
-static void nitro_queue_issue_callbacks(nitro_queue_t *q, int old_count);
+static NITRO_QUEUE_STATE nitro_queue_state(nitro_queue_t *q) {
+    return q->count == 0 ? NITRO_QUEUE_STATE_EMPTY :
+           (nitro_queue_full(q) ? NITRO_QUEUE_STATE_FULL :
+            NITRO_QUEUE_STATE_CONTENTS);
+}
 
 static void nitro_queue_grow(nitro_queue_t *q, int suggestion) {
     /* Assumed
@@ -91,6 +126,200 @@ static void nitro_queue_grow(nitro_queue_t *q, int suggestion) {
     }
 }
 
+/*
+ * Frames are kept ordered by priority (see frame.h), FIFO
+ * within a priority, so everything that pops from `head`
+ * (pull, fd_write) is strict-priority for free.  A frame goes
+ * in behind every frame of its own priority or higher, and
+ * ahead of the lower ones -- `prio_count` says how many of
+ * those there are, so normal traffic appends without looking
+ * and an urgent frame shuffles only what it overtakes.
+ *
+ * Assumes the lock is held and there is room.
+ */
+static void nitro_queue_insert(nitro_queue_t *q, nitro_frame_t *f) {
+    if (q->count == q->size) {
+        nitro_queue_grow(q, 0);
+    }
+
+    int behind = 0;
+    int p;
+
+    for (p = 0; p < f->priority; p++) {
+        behind += q->prio_count[p];
+    }
+
+    nitro_frame_t **slot = q->tail;
+
+    while (behind--) {
+        nitro_frame_t **prev = (slot == q->q ? q->end : slot) - 1;
+        *slot = *prev;
+        slot = prev;
+    }
+
+    *slot = f;
+    q->tail++;
+
+    if (q->tail == q->end) {
+        q->tail = q->q;
+    }
+
+    q->count++;
+    q->bytes += nitro_frame_size(f);
+    q->prio_count[f->priority]++;
+}
+
+/*
+ * Frames past their deadline (see nitro_frame_set_deadline)
+ * are dropped as they come off the queue, so nobody spends
+ * time delivering or writing work its sender gave up on.
+ * `now` is looked up once, and only if some frame has a
+ * deadline at all.
+ */
+static int nitro_queue_frame_expired(nitro_frame_t *f, double *now) {
+    if (!f->deadline) {
+        return 0;
+    }
+
+    if (!*now) {
+        *now = now_double();
+    }
+
+    return f->deadline <= *now;
+}
+
+static void nitro_queue_count_expired(nitro_queue_t *q, int n) {
+    if (n && q->stat_expired) {
+        __sync_fetch_and_add(q->stat_expired, n);
+    }
+}
+
+/* pop the head frame; lock held, queue not empty */
+static nitro_frame_t *nitro_queue_take(nitro_queue_t *q) {
+    nitro_frame_t *f = *q->head;
+    q->head++;
+
+    if (q->head == q->end) {
+        q->head = q->q;
+    }
+
+    q->count--;
+    q->bytes -= nitro_frame_size(f);
+    q->prio_count[f->priority]--;
+    return f;
+}
+
+/* pop the first live frame, dropping expired ones on the
+   way; NULL once the queue runs dry (lock held) */
+static nitro_frame_t *nitro_queue_take_live(nitro_queue_t *q,
+        double *now, int *expired) {
+    while (q->count) {
+        nitro_frame_t *f = nitro_queue_take(q);
+
+        if (!nitro_queue_frame_expired(f, now)) {
+            return f;
+        }
+
+        nitro_frame_destroy(f);
+        ++*expired;
+    }
+
+    return NULL;
+}
+
+static void nitro_queue_cond_init(pthread_cond_t *c) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+#ifdef NITRO_QUEUE_CONDATTR_CLOCK
+    pthread_condattr_setclock(&attr, NITRO_QUEUE_CLOCK);
+#endif
+    pthread_cond_init(c, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* absolute deadline `timeout` seconds from now */
+static void nitro_queue_deadline(double timeout, struct timespec *ts) {
+    clock_gettime(NITRO_QUEUE_CLOCK, ts);
+    time_t secs = (time_t)timeout;
+    long nsecs = ts->tv_nsec + (long)((timeout - secs) * 1000000000.0);
+    ts->tv_sec += secs + nsecs / 1000000000;
+    ts->tv_nsec = nsecs % 1000000000;
+}
+
+/* Sleep on `c` (lock held), forever if `deadline` is NULL;
+   returns -1 once the deadline has passed */
+static int nitro_queue_sleep(nitro_queue_t *q, pthread_cond_t *c,
+                             struct timespec *deadline) {
+    int r = 0;
+
+    if (!deadline) {
+        pthread_cond_wait(c, &q->lock);
+    } else {
+        r = pthread_cond_timedwait(c, &q->lock, deadline) == ETIMEDOUT ? -1 : 0;
+    }
+
+    ++q->stat_wakeups;
+    return r;
+}
+
+/*
+ * Waiters sleep on `not_empty` (pulls) or `not_full` (pushes),
+ * counted in `pull_waiters`/`push_waiters`, and each change
+ * wakes only as many as it can satisfy -- one per frame added
+ * or slot freed -- rather than the whole herd.  A thread that
+ * leaves its condition still true after acting passes the
+ * wakeup along, so a swallowed or stolen signal can't strand
+ * a sleeper.
+ */
+static int nitro_queue_wait(nitro_queue_t *q, pthread_cond_t *c,
+                            int *waiters, struct timespec *deadline) {
+    ++*waiters;
+    int r = nitro_queue_sleep(q, c, deadline);
+    --*waiters;
+    return r;
+}
+
+static void nitro_queue_wake(pthread_cond_t *c, int waiters, int n) {
+    if (!waiters || n <= 0) {
+        return;
+    }
+
+    if (n >= waiters) {
+        pthread_cond_broadcast(c);
+        return;
+    }
+
+    while (n--) {
+        pthread_cond_signal(c);
+    }
+}
+
+/* after adding `added` frames (lock held) */
+static void nitro_queue_wake_added(nitro_queue_t *q, int added) {
+    nitro_queue_wake(&q->not_empty, q->pull_waiters, added);
+
+    if (!nitro_queue_full(q)) {
+        nitro_queue_wake(&q->not_full, q->push_waiters, 1);
+    }
+}
+
+/* after removing `removed` frames (lock held) */
+static void nitro_queue_wake_removed(nitro_queue_t *q, int removed) {
+    if (!nitro_queue_full(q)) {
+        nitro_queue_wake(&q->not_full, q->push_waiters, removed);
+    }
+
+    if (q->count) {
+        nitro_queue_wake(&q->not_empty, q->pull_waiters, 1);
+    }
+}
+
+/* Waiting operations take a `timeout` in seconds: < 0 waits
+   forever, 0 never waits (EAGAIN), > 0 waits at most that
+   long (NITRO_ERR_TIMEOUT) */
+#define QUEUE_DEADLINE(timeout, ts) \
+    ((timeout) > 0 ? (nitro_queue_deadline(timeout, &(ts)), &(ts)) : NULL)
+
 nitro_queue_t *nitro_queue_new(int capacity,
                                nitro_queue_state_changed queue_cb, void *baton) {
     nitro_queue_t *q;
@@ -100,84 +329,736 @@ nitro_queue_t *nitro_queue_new(int capacity,
     q->baton = baton;
     q->send_target = QUEUE_FD_BUFFER_GUESS;
     pthread_mutex_init(&q->lock, NULL);
-    pthread_cond_init(&q->trigger, NULL);
+    nitro_queue_cond_init(&q->not_empty);
+    nitro_queue_cond_init(&q->not_full);
     nitro_queue_grow(q, 0);
 
     return q;
 }
 
-nitro_frame_t *nitro_queue_pull(nitro_queue_t *q,
-                                int wait) {
-    nitro_frame_t *ptr = NULL;
+/* Limit the queue by payload bytes as well as frame count.
+   Only meaningful before the queue is in use. */
+void nitro_queue_set_byte_capacity(nitro_queue_t *q, size_t byte_capacity) {
+    assert(!q->ring);
+    q->byte_capacity = byte_capacity;
+}
+
+/*
+ * Spill mode
+ * ----------
+ *
+ * Pushes onto a full queue go to a spill file under `dir`
+ * (see spill.h) instead of waiting, and whatever is taken
+ * off the queue is made up from the spill, oldest first.
+ * So the queue itself stays within its limits, producers
+ * never block, and order is kept: once anything has
+ * spilled, new frames spill behind it until it drains.
+ *
+ * If the spill file can't be written, pushes fall back to
+ * waiting for room as usual.
+ */
+void nitro_queue_set_spill(nitro_queue_t *q, const char *dir) {
+    assert(!q->ring);
+    q->spill = nitro_spill_new(dir);
+}
+
+/* lock held; 0 if `f` went to the spill (and was destroyed) */
+static int nitro_queue_spill(nitro_queue_t *q, nitro_frame_t *f) {
+    if (!q->spill ||
+            !(nitro_spill_count(q->spill) || nitro_queue_full(q)) ||
+            nitro_spill_append(q->spill, f)) {
+        return -1;
+    }
+
+    nitro_frame_destroy(f);
+    return 0;
+}
+
+/* lock held; refill from the spill after frames were taken */
+static void nitro_queue_unspill(nitro_queue_t *q) {
+    nitro_frame_t *f;
+
+    while (q->spill && !nitro_queue_full(q) &&
+            (f = nitro_spill_next(q->spill))) {
+        nitro_queue_insert(q, f);
+    }
+}
+
+/*
+ * Ring mode
+ * ---------
+ *
+ * A bounded queue where producers never take a lock: a push
+ * reserves a slot by bumping `count`, claims a cell by bumping
+ * `enqueue_pos`, and publishes the frame by advancing the
+ * cell's `seq`.  Consumers (pull, fd_write) take turns on the
+ * consumer-only `l_consume`, since fd_write must look at
+ * several frames, write, and only then pop them.
+ *
+ * Threads only sleep (on `lock` and `not_empty`/`not_full`)
+ * when the ring is empty or full, and are only woken if
+ * someone is asleep -- as many as there are new frames or
+ * freed slots.
+ *
+ * State callbacks are issued under `l_state` by whoever moves
+ * `count` across a state boundary, always reporting the state
+ * the queue is in *now*, so they never arrive stale.
+ *
+ * Cells are claimed in order, so a ring is plain FIFO: frame
+ * priorities are not honored.
+ */
+nitro_queue_t *nitro_queue_new_ring(int capacity,
+                                    nitro_queue_state_changed queue_cb, void *baton) {
+    if (capacity <= 0) {
+        /* unbounded queues need the growable array */
+        return nitro_queue_new(capacity, queue_cb, baton);
+    }
+
+    nitro_queue_t *q;
+    ZALLOC(q);
+    q->ring = 1;
+    q->capacity = capacity;
+    q->state_callback = queue_cb;
+    q->baton = baton;
+    q->send_target = QUEUE_FD_BUFFER_GUESS;
+    q->reported_state = NITRO_QUEUE_STATE_EMPTY;
+    pthread_mutex_init(&q->lock, NULL);
+    nitro_queue_cond_init(&q->not_empty);
+    nitro_queue_cond_init(&q->not_full);
+    pthread_mutex_init(&q->l_consume, NULL);
+    pthread_mutex_init(&q->l_state, NULL);
+
+    size_t size = 1;
+
+    while (size < (size_t)capacity) {
+        size <<= 1;
+    }
+
+    q->ring_mask = size - 1;
+    q->cells = malloc(size * sizeof(nitro_queue_cell));
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        q->cells[i].seq = i;
+    }
+
+    return q;
+}
+
+static NITRO_QUEUE_STATE nitro_queue_state_of(nitro_queue_t *q, int count) {
+    return count == 0 ? NITRO_QUEUE_STATE_EMPTY :
+           ((q->capacity && count >= q->capacity) ? NITRO_QUEUE_STATE_FULL :
+            NITRO_QUEUE_STATE_CONTENTS);
+}
+
+static void nitro_queue_ring_reconcile(nitro_queue_t *q) {
+    if (!q->state_callback) {
+        return;
+    }
+
+    pthread_mutex_lock(&q->l_state);
+    NITRO_QUEUE_STATE st = nitro_queue_state_of(
+                               q, __atomic_load_n(&q->count, __ATOMIC_ACQUIRE));
+
+    if (st != q->reported_state) {
+        NITRO_QUEUE_STATE last = q->reported_state;
+        q->reported_state = st;
+        q->state_callback(st, last, q->baton);
+    }
+
+    pthread_mutex_unlock(&q->l_state);
+}
+
+static int nitro_queue_ring_ready(nitro_queue_t *q) {
+    size_t pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_ACQUIRE);
+    nitro_queue_cell *cell = &q->cells[pos & q->ring_mask];
+    return __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) == pos + 1;
+}
+
+static int nitro_queue_ring_has_room(nitro_queue_t *q) {
+    return __atomic_load_n(&q->count, __ATOMIC_ACQUIRE) < q->capacity;
+}
+
+/* sleep until `ready`; `waiters` tells the other side to wake us */
+static int nitro_queue_ring_wait(nitro_queue_t *q, pthread_cond_t *c, int *waiters,
+                                 int (*ready)(nitro_queue_t *),
+                                 struct timespec *deadline) {
+    int r = 0;
     pthread_mutex_lock(&q->lock);
+    __atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
 
-    while (q->count == 0) {
-        if (!wait) {
-            pthread_mutex_unlock(&q->lock);
-            nitro_set_error(NITRO_ERR_EAGAIN);
-            return NULL;
+    while (!ready(q) && !r) {
+        r = nitro_queue_sleep(q, c, deadline);
+    }
+
+    __atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&q->lock);
+    return ready(q) ? 0 : r;
+}
+
+/* wake up to `n` of the threads sleeping on `c` */
+static void nitro_queue_ring_wake(nitro_queue_t *q, pthread_cond_t *c,
+                                  int *waiters, int n) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(waiters, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&q->lock);
+        nitro_queue_wake(c, *waiters, n);
+        pthread_mutex_unlock(&q->lock);
+    }
+}
+
+/* reserve up to `*n` slots (at least one); returns the count
+   before and sets `*n` to the number taken, or -1 if full */
+static int nitro_queue_ring_reserve_many(nitro_queue_t *q, int *n) {
+    int c = __atomic_load_n(&q->count, __ATOMIC_RELAXED);
+    int want = *n;
+
+    do {
+        if (c >= q->capacity) {
+            return -1;
         }
 
-        pthread_cond_wait(&q->trigger, &q->lock);
+        *n = (q->capacity - c < want) ? q->capacity - c : want;
+    } while (!__atomic_compare_exchange_n(&q->count, &c, c + *n,
+                                          1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    return c;
+}
+
+/* reserve a slot; returns the count before, or -1 if full */
+static int nitro_queue_ring_reserve(nitro_queue_t *q) {
+    int n = 1;
+    return nitro_queue_ring_reserve_many(q, &n);
+}
+
+/* fill a cell for a reserved slot */
+static void nitro_queue_ring_publish(nitro_queue_t *q, nitro_frame_t *f) {
+    size_t pos = __atomic_fetch_add(&q->enqueue_pos, 1, __ATOMIC_RELAXED);
+    nitro_queue_cell *cell = &q->cells[pos & q->ring_mask];
+
+    /* the reservation guarantees the cell is free; at worst the
+       consumer that freed it hasn't finished saying so */
+    while (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos) {
+        sched_yield();
     }
 
-    ptr = *q->head;
-    q->head++;
-    q->count--;
+    cell->frame = f;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+}
 
-    /* Wrap? */
-    if (q->head == q->end) {
-        q->head = q->q;
+/* the frame `i` places from the front (l_consume held), or NULL */
+static nitro_frame_t *nitro_queue_ring_peek(nitro_queue_t *q, int i) {
+    size_t pos = q->dequeue_pos + i;
+    nitro_queue_cell *cell = &q->cells[pos & q->ring_mask];
+
+    if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+        return NULL;
     }
 
-    nitro_queue_issue_callbacks(q, q->count + 1);
+    return cell->frame;
+}
+
+/* free the front cell (l_consume held) */
+static void nitro_queue_ring_drop(nitro_queue_t *q) {
+    size_t pos = q->dequeue_pos;
+    nitro_queue_cell *cell = &q->cells[pos & q->ring_mask];
+    __atomic_store_n(&q->dequeue_pos, pos + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&cell->seq, pos + q->ring_mask + 1, __ATOMIC_RELEASE);
+}
+
+/* release `n` slots after dropping their cells */
+static void nitro_queue_ring_release(nitro_queue_t *q, int n) {
+    if (!n) {
+        return;
+    }
 
-    if (q->capacity && q->count == (q->capacity - 1)) {
-        pthread_cond_broadcast(&q->trigger);
+    int old = __atomic_fetch_sub(&q->count, n, __ATOMIC_ACQ_REL);
+
+    if (nitro_queue_state_of(q, old) != nitro_queue_state_of(q, old - n)) {
+        nitro_queue_ring_reconcile(q);
     }
 
-    pthread_mutex_unlock(&q->lock);
+    nitro_queue_ring_wake(q, &q->not_full, &q->push_waiters, n);
+}
+
+static int nitro_queue_ring_push_batch(nitro_queue_t *q,
+                                       nitro_frame_t **frames, int n, double timeout) {
+    struct timespec ts;
+    struct timespec *deadline = QUEUE_DEADLINE(timeout, ts);
+    int total = 0;
+    NITRO_ERROR err = NITRO_ERR_EAGAIN;
+
+    while (total < n) {
+        int k = n - total;
+        int c = nitro_queue_ring_reserve_many(q, &k);
+
+        if (c < 0) {
+            if (!timeout) {
+                break;
+            }
+
+            if (nitro_queue_ring_wait(q, &q->not_full, &q->push_waiters,
+                                      nitro_queue_ring_has_room, deadline)) {
+                err = NITRO_ERR_TIMEOUT;
+                break;
+            }
+
+            continue;
+        }
+
+        int i;
+
+        for (i = 0; i < k; i++) {
+            nitro_queue_ring_publish(q, frames[total + i]);
+        }
+
+        total += k;
+
+        if (nitro_queue_state_of(q, c) != nitro_queue_state_of(q, c + k)) {
+            nitro_queue_ring_reconcile(q);
+        }
+
+        nitro_queue_ring_wake(q, &q->not_empty, &q->pull_waiters, k);
+    }
+
+    return (total || !n) ? total : nitro_set_error(err);
+}
+
+static int nitro_queue_ring_pull_batch(nitro_queue_t *q,
+                                       nitro_frame_t **frames, int max, double timeout) {
+    struct timespec ts;
+    struct timespec *deadline = QUEUE_DEADLINE(timeout, ts);
+    double now = 0;
+    int n, expired;
+
+    while (1) {
+        pthread_mutex_lock(&q->l_consume);
+
+        nitro_frame_t *fr;
+        n = expired = 0;
+
+        while (n < max && (fr = nitro_queue_ring_peek(q, 0))) {
+            nitro_queue_ring_drop(q);
+
+            if (nitro_queue_frame_expired(fr, &now)) {
+                nitro_frame_destroy(fr);
+                ++expired;
+            } else {
+                frames[n++] = fr;
+            }
+        }
+
+        pthread_mutex_unlock(&q->l_consume);
+        nitro_queue_ring_release(q, n + expired);
+        nitro_queue_count_expired(q, expired);
+
+        if (n) {
+            return n;
+        }
+
+        if (expired) {
+            continue;
+        }
+
+        if (!timeout) {
+            return nitro_set_error(NITRO_ERR_EAGAIN);
+        }
+
+        if (nitro_queue_ring_wait(q, &q->not_empty, &q->pull_waiters,
+                                  nitro_queue_ring_ready, deadline)) {
+            return nitro_set_error(NITRO_ERR_TIMEOUT);
+        }
+    }
+}
+
+static void nitro_queue_ring_consume(nitro_queue_t *q,
+                                     nitro_queue_frame_generator gen,
+                                     void *baton) {
+    int crossed = 0, pushed = 0;
+    int c;
+
+    while ((c = nitro_queue_ring_reserve(q)) >= 0) {
+        nitro_frame_t *fr = gen(baton);
+
+        if (!fr) {
+            __atomic_sub_fetch(&q->count, 1, __ATOMIC_ACQ_REL);
+            crossed |= (nitro_queue_state_of(q, c) != nitro_queue_state_of(q, c + 1));
+            break;
+        }
+
+        nitro_queue_ring_publish(q, fr);
+        crossed |= (nitro_queue_state_of(q, c) != nitro_queue_state_of(q, c + 1));
+        ++pushed;
+    }
+
+    if (crossed) {
+        nitro_queue_ring_reconcile(q);
+    }
+
+    if (pushed) {
+        nitro_queue_ring_wake(q, &q->not_empty, &q->pull_waiters, pushed);
+    }
+}
+
+nitro_frame_t *nitro_queue_pull(nitro_queue_t *q,
+                                int wait) {
+    return nitro_queue_pull_timeout(q, wait ? -1 : 0);
+}
+
+/*
+ * As nitro_queue_pull, but giving up (NITRO_ERR_TIMEOUT)
+ * after `timeout` seconds; see QUEUE_DEADLINE.
+ */
+nitro_frame_t *nitro_queue_pull_timeout(nitro_queue_t *q,
+                                        double timeout) {
+    nitro_frame_t *ptr = NULL;
+    nitro_queue_pull_batch_timeout(q, &ptr, 1, timeout);
     return ptr;
 }
 
+/*
+ * Pull up to `max` frames into `frames` in one go, waiting
+ * (if `wait`) only until there is at least one.  State
+ * callbacks fire once for the whole batch.
+ *
+ * Returns the number of frames pulled, or -1 (EAGAIN) if
+ * the queue was empty and we were told not to wait.
+ */
+int nitro_queue_pull_batch(nitro_queue_t *q,
+                           nitro_frame_t **frames, int max, int wait) {
+    return nitro_queue_pull_batch_timeout(q, frames, max, wait ? -1 : 0);
+}
+
+int nitro_queue_pull_batch_timeout(nitro_queue_t *q,
+                                   nitro_frame_t **frames, int max, double timeout) {
+    if (q->ring) {
+        return nitro_queue_ring_pull_batch(q, frames, max, timeout);
+    }
+
+    struct timespec ts;
+    struct timespec *deadline = QUEUE_DEADLINE(timeout, ts);
+    int n = 0;
+    pthread_mutex_lock(&q->lock);
+
+    /* if everything was expired, go back to waiting */
+    while (1) {
+        while (q->count == 0) {
+            if (!timeout) {
+                pthread_mutex_unlock(&q->lock);
+                return nitro_set_error(NITRO_ERR_EAGAIN);
+            }
+
+            if (nitro_queue_wait(q, &q->not_empty, &q->pull_waiters, deadline)
+                    && q->count == 0) {
+                pthread_mutex_unlock(&q->lock);
+                return nitro_set_error(NITRO_ERR_TIMEOUT);
+            }
+        }
+
+        NITRO_QUEUE_STATE old_state = nitro_queue_state(q);
+        double now = 0;
+        int expired = 0;
+        nitro_frame_t *fr;
+
+        while (n < max && (fr = nitro_queue_take_live(q, &now, &expired))) {
+            frames[n++] = fr;
+        }
+
+        nitro_queue_unspill(q);
+        nitro_queue_issue_callbacks(q, old_state);
+        nitro_queue_wake_removed(q, n + expired);
+        nitro_queue_count_expired(q, expired);
+
+        if (n || !max) {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
+
 int nitro_queue_push(nitro_queue_t *q,
                      nitro_frame_t *f, int wait) {
+    return nitro_queue_push_timeout(q, f, wait ? -1 : 0);
+}
+
+/*
+ * As nitro_queue_push, but giving up (NITRO_ERR_TIMEOUT)
+ * after `timeout` seconds; see QUEUE_DEADLINE.
+ */
+int nitro_queue_push_timeout(nitro_queue_t *q,
+                             nitro_frame_t *f, double timeout) {
+    if (q->ring) {
+        return nitro_queue_ring_push_batch(q, &f, 1, timeout) == 1 ? 0 : -1;
+    }
+
+    struct timespec ts;
+    struct timespec *deadline = QUEUE_DEADLINE(timeout, ts);
     pthread_mutex_lock(&q->lock);
 
-    while (q->capacity && q->count == q->capacity) {
-        if (!wait) {
+    if (!nitro_queue_spill(q, f)) {
+        pthread_mutex_unlock(&q->lock);
+        return 0;
+    }
+
+    while (nitro_queue_full(q)) {
+        if (!timeout) {
             pthread_mutex_unlock(&q->lock);
             return nitro_set_error(NITRO_ERR_EAGAIN);
         }
 
-        pthread_cond_wait(&q->trigger, &q->lock);
+        if (nitro_queue_wait(q, &q->not_full, &q->push_waiters, deadline)
+                && nitro_queue_full(q)) {
+            pthread_mutex_unlock(&q->lock);
+            return nitro_set_error(NITRO_ERR_TIMEOUT);
+        }
     }
 
-    if (q->count == q->size) {
-        nitro_queue_grow(q, 0);
-    }
+    NITRO_QUEUE_STATE old_state = nitro_queue_state(q);
+    nitro_queue_insert(q, f);
 
-    /* tail marks to the next empty spot */
-    *q->tail = f;
-    q->tail++;
-    q->count++;
+    nitro_queue_issue_callbacks(q, old_state);
+    nitro_queue_wake_added(q, 1);
 
-    if (q->tail == q->end) {
-        q->tail = q->q;
+    pthread_mutex_unlock(&q->lock);
+
+    return 0;
+}
+
+/*
+ * Push as many of the `n` frames in `frames` as will fit,
+ * in order, waiting for room (if `wait`) until all are in.
+ * Each stretch that fits goes in under one lock, with one
+ * state callback.
+ *
+ * Returns the number of frames taken (always a prefix of
+ * `frames`), or -1 (EAGAIN) if the queue was full and we
+ * were told not to wait.
+ */
+int nitro_queue_push_batch(nitro_queue_t *q,
+                           nitro_frame_t **frames, int n, int wait) {
+    return nitro_queue_push_batch_timeout(q, frames, n, wait ? -1 : 0);
+}
+
+int nitro_queue_push_batch_timeout(nitro_queue_t *q,
+                                   nitro_frame_t **frames, int n, double timeout) {
+    if (q->ring) {
+        return nitro_queue_ring_push_batch(q, frames, n, timeout);
     }
 
-    nitro_queue_issue_callbacks(q, q->count - 1);
+    struct timespec ts;
+    struct timespec *deadline = QUEUE_DEADLINE(timeout, ts);
+    NITRO_ERROR err = NITRO_ERR_EAGAIN;
+    int total = 0;
+    pthread_mutex_lock(&q->lock);
+
+    while (total < n) {
+        if (!nitro_queue_spill(q, frames[total])) {
+            total++;
+            continue;
+        }
 
-    if (q->count == 1) {
-        pthread_cond_broadcast(&q->trigger);
+        if (nitro_queue_full(q)) {
+            if (!timeout) {
+                break;
+            }
+
+            if (nitro_queue_wait(q, &q->not_full, &q->push_waiters, deadline)
+                    && nitro_queue_full(q)) {
+                err = NITRO_ERR_TIMEOUT;
+                break;
+            }
+
+            continue;
+        }
+
+        NITRO_QUEUE_STATE old_state = nitro_queue_state(q);
+        int added = total;
+
+        while (total < n && !nitro_queue_full(q)) {
+            nitro_queue_insert(q, frames[total++]);
+        }
+
+        nitro_queue_issue_callbacks(q, old_state);
+        nitro_queue_wake_added(q, total - added);
     }
 
     pthread_mutex_unlock(&q->lock);
 
-    return 0;
+    return (total || !n) ? total : nitro_set_error(err);
+}
+
+static inline int nitro_queue_iov_total(struct iovec *vs, int num) {
+    int i, total = 0;
+
+    for (i = 0; i < num; i++) {
+        total += vs[i].iov_len;
+    }
+
+    return total;
+}
+
+/*
+ * File-backed frames
+ * ------------------
+ *
+ * A file-backed frame's payload iovec holds a file offset
+ * rather than a pointer (see nitro_frame_iovs).  The
+ * gathered vectors are written in runs: writev() up to a
+ * file payload, sendfile() for the payload, and on.  The
+ * kernel moves the payload, so it is never read into
+ * memory.  Returns bytes written, stopping at the first
+ * short write, or -1 if nothing could be written.
+ */
+static ssize_t nitro_queue_send_file(int fd, int file_fd, off_t offset, size_t len) {
+#ifdef __linux__
+    return sendfile(fd, file_fd, &offset, len);
+#else
+    char buf[64 * 1024];
+    ssize_t r = pread(file_fd, buf, len < sizeof(buf) ? len : sizeof(buf), offset);
+    return r <= 0 ? r : write(fd, buf, r);
+#endif
+}
+
+static int nitro_queue_writev_files(int fd, struct iovec *vs, int num,
+                                    int *file_at, int *file_fd, int nfiles) {
+    int total = 0, start = 0, k;
+
+    for (k = 0; k <= nfiles; k++) {
+        int stop = k < nfiles ? file_at[k] : num;
+
+        if (stop > start) {
+            int want = nitro_queue_iov_total(vs + start, stop - start);
+            int w = writev(fd, vs + start, stop - start);
+
+            if (w == -1) {
+                return total ? total : -1;
+            }
+
+            total += w;
+
+            if (w < want) {
+                return total;
+            }
+        }
+
+        if (k == nfiles) {
+            break;
+        }
+
+        size_t len = vs[stop].iov_len;
+
+        if (len) {
+            ssize_t w = nitro_queue_send_file(fd, file_fd[k],
+                                              (off_t)(uintptr_t)vs[stop].iov_base, len);
+
+            if (w == -1) {
+                return total ? total : -1;
+            }
+
+            total += w;
+
+            if (w < len) {
+                return total;
+            }
+        }
+
+        start = stop + 1;
+    }
+
+    return total;
+}
+
+/* the frame `i` places from the front, or NULL (consumer lock held) */
+static nitro_frame_t *nitro_queue_peek(nitro_queue_t *q, int i) {
+    if (q->ring) {
+        return nitro_queue_ring_peek(q, i);
+    }
+
+    if (i >= q->count) {
+        return NULL;
+    }
+
+    nitro_frame_t **slot = q->head + i;
+
+    if (slot >= q->end) {
+        slot -= q->end - q->q;
+    }
+
+    return *slot;
 }
 
-#define IOV_TOTAL(i) ((i[0].iov_len) + (i[1].iov_len) + (i[2].iov_len) + (i[3].iov_len))
+static void nitro_queue_drop_front(nitro_queue_t *q) {
+    if (q->ring) {
+        nitro_queue_ring_drop(q);
+    } else {
+        nitro_queue_take(q);
+    }
+}
+
+/* Drop anything expired at the front; returns how many */
+static int nitro_queue_drop_expired(nitro_queue_t *q, double *now) {
+    int expired = 0;
+    nitro_frame_t *fr;
+
+    while ((fr = nitro_queue_peek(q, 0)) && nitro_queue_frame_expired(fr, now)) {
+        nitro_queue_drop_front(q);
+        nitro_frame_destroy(fr);
+        ++expired;
+    }
+
+    return expired;
+}
+
+/* Drop (and destroy) the n frames at the front */
+static void nitro_queue_drop_run(nitro_queue_t *q, int n) {
+    while (n--) {
+        nitro_frame_t *fr = nitro_queue_peek(q, 0);
+        nitro_queue_drop_front(q);
+        nitro_frame_destroy(fr);
+    }
+}
+
+/*
+ * Batching
+ * --------
+ *
+ * When two or more small data frames (nitro_frame_batchable)
+ * are next in line, they go out as one BATCH packet: one
+ * protocol header, then a 4-byte nitro_batch_header per
+ * frame instead of an 8-byte protocol header each, and one
+ * box instead of many on secure sockets.
+ *
+ * nitro_queue_pack_batch copies up to `max` frames starting
+ * `start` places back into a packet, but leaves them queued;
+ * the caller drops them once the packet is theirs to send.
+ * A run stops at an expired frame, which is left to be
+ * dropped at the front next time.
+ */
+static nitro_frame_t *nitro_queue_pack_batch(nitro_queue_t *q,
+        int start, int max, double *now, int *count) {
+    nitro_frame_t *frames[NITRO_FRAME_BATCH_MAX];
+    nitro_frame_t *fr;
+    int n = 0;
+
+    if (max > NITRO_FRAME_BATCH_MAX) {
+        max = NITRO_FRAME_BATCH_MAX;
+    }
+
+    while (n < max && (fr = nitro_queue_peek(q, start + n)) &&
+            nitro_frame_batchable(fr) && !nitro_queue_frame_expired(fr, now)) {
+        frames[n++] = fr;
+    }
+
+    if (n < 2) {
+        return NULL;
+    }
+
+    *count = n;
+    return nitro_frame_batch(frames, n);
+}
 
 /* "internal" functions, mass population and eviction */
 int nitro_queue_fd_write(nitro_queue_t *q, int fd,
@@ -186,45 +1067,91 @@ int nitro_queue_fd_write(nitro_queue_t *q, int fd,
                          int *frames_written
                         ) {
     /* Does gather IO to avoid copying buffers around */
-    pthread_mutex_lock(&q->lock);
+    pthread_mutex_t *lock = q->ring ? &q->l_consume : &q->lock;
+    pthread_mutex_lock(lock);
     int actual_iovs = 0;
     int accum_bytes = 0;
     int ret = 0;
     int fwritten = 0;
-    nitro_frame_t **iter = q->head;
+    int popped = 0;
+    int expired = 0;
+    double now = 0;
     struct iovec vectors[NITRO_MAX_IOV];
+    int file_at[QUEUE_FD_MAX_FILES], file_fd[QUEUE_FD_MAX_FILES];
+    int nfiles = 0;
+    /* What was gathered, in order: queued frames (runs[u] == 0)
+       or BATCH packets packed from runs[u] queued frames */
+    nitro_frame_t *units[NITRO_MAX_IOV];
+    int runs[NITRO_MAX_IOV];
+    int nunits = 0, u = 0;
+    NITRO_QUEUE_STATE old_state = q->ring ? NITRO_QUEUE_STATE_EMPTY : nitro_queue_state(q);
+
+    /* The gather below stops short of any later expired
+       frame, so it reaches the front (and is dropped) before
+       it can be written */
+    expired = nitro_queue_drop_expired(q, &now);
+    /* counted now, so the drops show before anything
+       written after them can be received */
+    nitro_queue_count_expired(q, expired);
 
     if (partial) {
         int num;
         struct iovec *f_vs = nitro_frame_iovs(partial, &num);
         memcpy(&(vectors[0]), f_vs, num * sizeof(struct iovec));
-        accum_bytes += IOV_TOTAL(f_vs);
+
+        if (partial->file) {
+            file_at[nfiles] = 1;
+            file_fd[nfiles++] = partial->file->fd;
+        }
+
+        accum_bytes += nitro_queue_iov_total(f_vs, num);
         actual_iovs += num;
     }
 
-    int old_count = q->count;
+    int old_count = q->ring ?
+                    __atomic_load_n(&q->count, __ATOMIC_ACQUIRE) - expired : q->count;
     int temp_count = old_count;
     int byte_target = q->send_target + QUEUE_FD_BUFFER_PADDING;;
 
-    while (accum_bytes < byte_target && actual_iovs < (NITRO_MAX_IOV - 5) && temp_count) {
+    while (accum_bytes < byte_target && actual_iovs <= (NITRO_MAX_IOV - NITRO_FRAME_MAX_IOV)
+            && nfiles < QUEUE_FD_MAX_FILES && temp_count) {
+        int taken = old_count - temp_count;
+        nitro_frame_t *fr = nitro_queue_peek(q, taken);
+        int run = 0;
+
+        if (!fr || nitro_queue_frame_expired(fr, &now)) {
+            break;
+        }
+
+        nitro_frame_t *batch = nitro_queue_pack_batch(q, taken, temp_count, &now, &run);
+
+        if (batch) {
+            fr = batch;
+        }
+
         int num;
-        struct iovec *f_vs = nitro_frame_iovs(*iter, &num);
+        struct iovec *f_vs = nitro_frame_iovs(fr, &num);
         memcpy(&(vectors[actual_iovs]), f_vs, num * sizeof(struct iovec));
-        accum_bytes += IOV_TOTAL(f_vs);
-        actual_iovs += num;
-        ++iter;
-        --temp_count;
 
-        if (iter == q->end) {
-            iter = q->q;
+        if (fr->file) {
+            file_at[nfiles] = actual_iovs + 1;
+            file_fd[nfiles++] = fr->file->fd;
         }
+
+        accum_bytes += nitro_queue_iov_total(f_vs, num);
+        actual_iovs += num;
+        units[nunits] = fr;
+        runs[nunits++] = run;
+        temp_count -= run ? run : 1;
     }
 
     if (!accum_bytes) {
         goto out;
     }
 
-    int actual_bytes = writev(fd, (const struct iovec *)vectors, actual_iovs);
+    int actual_bytes = nfiles ?
+                       nitro_queue_writev_files(fd, vectors, actual_iovs, file_at, file_fd, nfiles) :
+                       writev(fd, (const struct iovec *)vectors, actual_iovs);
 
     /* On error, we don't move the queue pointers at all.
        We'll let the caller sort out the errno. */
@@ -240,7 +1167,8 @@ int nitro_queue_fd_write(nitro_queue_t *q, int fd,
        advancing the queue; if a frame is left partially sent
        at the end, update its iovectors to represent the fractional
        state and return it as a "remainder" (but still pop it off
-       this queue) */
+       this queue).  A BATCH packet is popped as its whole run,
+       and is already ours to return as the remainder */
     int i = 0, r = 0, done = 0;
     *remain = NULL;
 
@@ -253,58 +1181,119 @@ int nitro_queue_fd_write(nitro_queue_t *q, int fd,
         } while (actual_bytes && !done);
 
         if (done) {
+            /* a BATCH's frames were counted when it was packed */
+            fwritten += partial->type != NITRO_FRAME_BATCH;
             nitro_frame_destroy(partial);
-            ++fwritten;
         } else {
             assert(!actual_bytes);
             *remain = partial;
         }
     }
 
-    while (actual_bytes) {
-        nitro_frame_t *fr = *q->head;
-        struct iovec scratch[4];
+    for (; actual_bytes; u++) {
+        nitro_frame_t *fr = units[u];
+        struct iovec scratch[NITRO_FRAME_MAX_IOV];
+        struct iovec *vs = runs[u] ? fr->iovs : scratch;
         memcpy(scratch, fr->iovs, sizeof(scratch));
         i = 0;
 
         do {
-            r = nitro_frame_iovs_advance(fr, scratch, i++, actual_bytes, &done);
+            r = nitro_frame_iovs_advance(fr, vs, i++, actual_bytes, &done);
             actual_bytes -= r;
         } while (actual_bytes && !done);
 
-        if (done) {
-            ++fwritten;
-        } else {
+        if (!done) {
             assert(!actual_bytes);
-            *remain = nitro_frame_copy_partial(fr, scratch);
         }
-        nitro_frame_destroy(fr);
 
-        q->head++;
+        if (runs[u]) {
+            fwritten += runs[u];
+            popped += runs[u];
+            nitro_queue_drop_run(q, runs[u]);
 
-        if (q->head == q->end) {
-            q->head = q->q;
+            if (done) {
+                nitro_frame_destroy(fr);
+            } else {
+                *remain = fr;
+            }
+        } else {
+            if (done) {
+                ++fwritten;
+            } else {
+                *remain = nitro_frame_copy_partial(fr, scratch);
+            }
+
+            ++popped;
+            nitro_queue_drop_run(q, 1);
         }
+    }
 
-        q->count--;
+    if (old_count - popped && ret > 0) {
+        q->send_target = ret >  QUEUE_FD_BUFFER_GUESS ? QUEUE_FD_BUFFER_GUESS : ret;
     }
 
-    nitro_queue_issue_callbacks(q, old_count);
+out:
+    /* packets that didn't go out; their frames are still queued */
+    for (; u < nunits; u++) {
+        if (runs[u]) {
+            nitro_frame_destroy(units[u]);
+        }
+    }
 
-    if (q->capacity && old_count == q->capacity && q->count < old_count) {
-        pthread_cond_broadcast(&q->trigger);
+    if (!q->ring) {
+        nitro_queue_unspill(q);
+        nitro_queue_issue_callbacks(q, old_state);
+        nitro_queue_wake_removed(q, popped + expired);
     }
 
-    if (q->count && ret > 0) {
-        q->send_target = ret >  QUEUE_FD_BUFFER_GUESS ? QUEUE_FD_BUFFER_GUESS : ret;
+    pthread_mutex_unlock(lock);
+
+    if (q->ring) {
+        nitro_queue_ring_release(q, popped + expired);
     }
 
-out:
-    pthread_mutex_unlock(&q->lock);
     *frames_written = fwritten;
     return ret;
 }
 
+/* Take the next thing to encrypt and write: a BATCH of
+   small frames if there is one, else a frame.  `count`
+   is how many queued frames it accounts for */
+static nitro_frame_t *nitro_queue_pull_wire(nitro_queue_t *q, int *count) {
+    pthread_mutex_t *lock = q->ring ? &q->l_consume : &q->lock;
+    pthread_mutex_lock(lock);
+    NITRO_QUEUE_STATE old_state = q->ring ? NITRO_QUEUE_STATE_EMPTY : nitro_queue_state(q);
+    double now = 0;
+    int n = 0;
+
+    int expired = nitro_queue_drop_expired(q, &now);
+    nitro_frame_t *fr = nitro_queue_pack_batch(q, 0, NITRO_FRAME_BATCH_MAX, &now, &n);
+
+    if (fr) {
+        nitro_queue_drop_run(q, n);
+    } else if ((fr = nitro_queue_peek(q, 0))) {
+        nitro_queue_drop_front(q);
+        n = 1;
+    }
+
+    if (!q->ring) {
+        nitro_queue_unspill(q);
+        nitro_queue_issue_callbacks(q, old_state);
+        nitro_queue_wake_removed(q, n + expired);
+    }
+
+    pthread_mutex_unlock(lock);
+
+    if (q->ring) {
+        nitro_queue_ring_release(q, n + expired);
+    }
+
+    nitro_queue_count_expired(q, expired);
+
+    *count = n;
+    return fr;
+}
+
 int nitro_queue_fd_write_encrypted(nitro_queue_t *q, int fd,
                                    nitro_frame_t *partial,
                                    nitro_frame_t **remain,
@@ -315,9 +1304,12 @@ int nitro_queue_fd_write_encrypted(nitro_queue_t *q, int fd,
     int fwritten = 0;
 
     nitro_frame_t *current = partial;
+    int n;
 
+    /* frames count as written once they're boxed */
     if (!current) {
-        nitro_frame_t *clear = nitro_queue_pull(q, 0);
+        nitro_frame_t *clear = nitro_queue_pull_wire(q, &n);
+        fwritten += n;
 
         if (clear) {
             current = encrypt(clear, enc_baton);
@@ -358,8 +1350,8 @@ int nitro_queue_fd_write_encrypted(nitro_queue_t *q, int fd,
 
         if (done) {
             nitro_frame_destroy(current);
-            ++fwritten;
-            nitro_frame_t *clear = nitro_queue_pull(q, 0);
+            nitro_frame_t *clear = nitro_queue_pull_wire(q, &n);
+            fwritten += n;
 
             if (clear) {
                 current = encrypt(clear, enc_baton);
@@ -384,6 +1376,8 @@ int nitro_queue_fd_write_encrypted(nitro_queue_t *q, int fd,
                            (b < c ? b : c))
 
 void nitro_queue_move(nitro_queue_t *src, nitro_queue_t *dst) {
+    /* dst is unbounded, so never a ring */
+    assert(!src->ring);
     pthread_mutex_lock(&dst->lock);
     assert(!dst->capacity);
 
@@ -391,6 +1385,9 @@ void nitro_queue_move(nitro_queue_t *src, nitro_queue_t *dst) {
     pthread_mutex_lock(&src->lock);
 
     int src_count = src->count;
+    size_t src_bytes = src->bytes;
+    int src_prio[NITRO_PRIORITY_LEVELS];
+    memcpy(src_prio, src->prio_count, sizeof(src_prio));
     nitro_frame_t **src_q = NULL;
     nitro_frame_t **src_head = NULL;
     nitro_frame_t **src_end = NULL;
@@ -400,19 +1397,53 @@ void nitro_queue_move(nitro_queue_t *src, nitro_queue_t *dst) {
         src_head = src->head;
         src_end = src->end;
 
+        NITRO_QUEUE_STATE src_state = nitro_queue_state(src);
         src->q = src->head = src->tail = src->end = NULL;
         src->count = src->size = 0;
+        src->bytes = 0;
+        bzero(src->prio_count, sizeof(src->prio_count));
 
-        nitro_queue_issue_callbacks(src, src_count);
+        nitro_queue_issue_callbacks(src, src_state);
+        nitro_queue_wake_removed(src, src_count);
     }
 
     pthread_mutex_unlock(&src->lock);
     /* done! */
+    int dst_count = dst->count;
 
     if (!src_count) {
         goto out;
     }
 
+    NITRO_QUEUE_STATE dst_state = nitro_queue_state(dst);
+    int p;
+
+    /* Would anything in src overtake something in dst?  Then
+       they have to go in one by one, in priority order */
+    int dst_low = 0, src_high = NITRO_PRIORITY_MAX;
+
+    while (dst_low < NITRO_PRIORITY_MAX && !dst->prio_count[dst_low]) {
+        dst_low++;
+    }
+
+    while (src_high > 0 && !src_prio[src_high]) {
+        src_high--;
+    }
+
+    if (dst->count && src_high > dst_low) {
+        nitro_frame_t **f_src = src_head;
+
+        while (src_count--) {
+            nitro_queue_insert(dst, *f_src++);
+
+            if (f_src == src_end) {
+                f_src = src_q;
+            }
+        }
+
+        goto done;
+    }
+
     int final_size = dst->count + src_count;
 
     if (dst->size < final_size) {
@@ -424,7 +1455,6 @@ void nitro_queue_move(nitro_queue_t *src, nitro_queue_t *dst) {
     int copy_left = src_count;
 
     nitro_frame_t **f_dst = dst->tail, **f_src = src_head;
-    int dst_old_count = dst->count;
 
     while (1) {
         int copy_now = MIN3(
@@ -456,8 +1486,15 @@ void nitro_queue_move(nitro_queue_t *src, nitro_queue_t *dst) {
 
     dst->tail = f_dst;
     dst->count += src_count;
+    dst->bytes += src_bytes;
+
+    for (p = 0; p < NITRO_PRIORITY_LEVELS; p++) {
+        dst->prio_count[p] += src_prio[p];
+    }
 
-    nitro_queue_issue_callbacks(dst, dst_old_count);
+done:
+    nitro_queue_issue_callbacks(dst, dst_state);
+    nitro_queue_wake_added(dst, dst->count - dst_count);
     /* we now own this, so let's dealloc it */
     free(src_q);
 out:
@@ -465,6 +1502,21 @@ out:
 }
 
 void nitro_queue_destroy(nitro_queue_t *q) {
+    if (q->ring) {
+        nitro_frame_t *fr;
+
+        while ((fr = nitro_queue_ring_peek(q, 0))) {
+            nitro_queue_ring_drop(q);
+            nitro_frame_destroy(fr);
+        }
+
+        free(q->cells);
+        pthread_mutex_destroy(&q->l_consume);
+        pthread_mutex_destroy(&q->l_state);
+        free(q);
+        return;
+    }
+
     while (q->head != q->tail) {
         nitro_frame_destroy(*q->head);
         q->head++;
@@ -474,6 +1526,10 @@ void nitro_queue_destroy(nitro_queue_t *q) {
         }
     }
 
+    if (q->spill) {
+        nitro_spill_destroy(q->spill);
+    }
+
     free(q->q);
     free(q);
 }
@@ -488,73 +1544,50 @@ static void nitro_queue_shrink(nitro_queue_t *q) {
 }
 
 static void nitro_queue_issue_callbacks(nitro_queue_t *q,
-                                        int old_count) {
+                                        NITRO_QUEUE_STATE old_state) {
     if (!q->state_callback) {
         return;
     }
 
-    int old_state = (old_count == 0 ? NITRO_QUEUE_STATE_EMPTY :
-                     ((q->capacity && old_count == q->capacity) ? NITRO_QUEUE_STATE_FULL :
-                      NITRO_QUEUE_STATE_CONTENTS));
+    NITRO_QUEUE_STATE st = nitro_queue_state(q);
 
-    /* 1. EMPTY to FULL|CONTENTS */
-    if (old_count == 0 && q->count) {
-        q->state_callback(
-            (!q->capacity || q->count < q->capacity) ?
-            NITRO_QUEUE_STATE_CONTENTS :
-            NITRO_QUEUE_STATE_FULL, old_state, q->baton);
+    /* EMPTY, CONTENTS and FULL; report any move between them */
+    if (st == old_state) {
+        return;
     }
 
-    /* 2. FULL|CONTENTS to EMPTY */
-    else if (old_count > 0 && !q->count) {
+    if (st == NITRO_QUEUE_STATE_EMPTY) {
         nitro_queue_shrink(q);
-        q->state_callback(NITRO_QUEUE_STATE_EMPTY, old_state, q->baton);
     }
 
-    else if (q->capacity) {
-        /* 3. FULL to CONTENTS */
-        if (old_count == q->capacity && q->count < q->capacity) {
-            q->state_callback(NITRO_QUEUE_STATE_CONTENTS, old_state, q->baton);
-        }
-        /* 4. CONTENTS to FULL */
-        else if (old_count < q->capacity && q->count == q->capacity) {
-            q->state_callback(NITRO_QUEUE_STATE_FULL, old_state, q->baton);
-        }
-    }
+    q->state_callback(st, old_state, q->baton);
 }
 
 void nitro_queue_consume(nitro_queue_t *q,
                          nitro_queue_frame_generator gen,
                          void *baton) {
+    if (q->ring) {
+        nitro_queue_ring_consume(q, gen, baton);
+        return;
+    }
+
     pthread_mutex_lock(&q->lock);
 
+    NITRO_QUEUE_STATE old_state = nitro_queue_state(q);
     int old_count = q->count;
 
-    while (!q->capacity || q->count < q->capacity) {
+    while (!nitro_queue_full(q)) {
         nitro_frame_t *fr = gen(baton);
 
         if (!fr) {
             break;
         }
 
-        if (q->count == q->size) {
-            nitro_queue_grow(q, 0);
-        }
-
-        *q->tail = fr;
-        q->tail++;
-        q->count++;
-
-        if (q->tail == q->end) {
-            q->tail = q->q;
-        }
+        nitro_queue_insert(q, fr);
     }
 
-    nitro_queue_issue_callbacks(q, old_count);
-
-    if (old_count == 0 && q->count > 0) {
-        pthread_cond_broadcast(&q->trigger);
-    }
+    nitro_queue_issue_callbacks(q, old_state);
+    nitro_queue_wake_added(q, q->count - old_count);
 
     pthread_mutex_unlock(&q->lock);
 }
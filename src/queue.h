@@ -47,6 +47,7 @@
 
 #include "common.h"
 #include "frame.h"
+#include "spill.h"
 
 #define QUEUE_GROWTH_FACTOR 3
 #define INITIAL_QUEUE_SZ 1024
@@ -60,6 +61,11 @@ typedef enum {
 
 typedef void (*nitro_queue_state_changed)(NITRO_QUEUE_STATE st, NITRO_QUEUE_STATE last, void *baton);
 
+typedef struct nitro_queue_cell {
+    size_t seq;
+    nitro_frame_t *frame;
+} nitro_queue_cell;
+
 /* Queue of Frames */
 typedef struct nitro_queue_t {
     nitro_frame_t **q;
@@ -70,20 +76,70 @@ typedef struct nitro_queue_t {
     int count;
     int capacity;
     int send_target;
+    /* payload bytes queued, and the limit on them (0 = none) */
+    size_t bytes;
+    size_t byte_capacity;
+    /* frames queued at each priority; the ring is kept
+       sorted by priority (see nitro_queue_insert) */
+    int prio_count[NITRO_PRIORITY_LEVELS];
+    /* bumped for each frame dropped past its deadline, if set */
+    uint64_t *stat_expired;
+    /* overflow beyond capacity, if set (see nitro_queue_set_spill) */
+    nitro_spill_t *spill;
     pthread_mutex_t lock;
-    pthread_cond_t trigger;
+    /* pulls sleep on `not_empty`, pushes on `not_full` */
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
 
     nitro_queue_state_changed state_callback;
     void *baton;
 
+    /* Ring mode (see nitro_queue_new_ring).  `count` counts
+       reserved slots; `lock` and the conds are only used to sleep */
+    int ring;
+    nitro_queue_cell *cells;
+    size_t ring_mask;
+    char pad1[64];
+    size_t enqueue_pos;
+    char pad2[64];
+    size_t dequeue_pos;
+    char pad3[64];
+    /* consumers (pull, fd_write) take turns on this */
+    pthread_mutex_t l_consume;
+    /* serializes state callbacks */
+    pthread_mutex_t l_state;
+    NITRO_QUEUE_STATE reported_state;
+    /* threads asleep in pull/push, so wakes can be counted out */
+    int pull_waiters;
+    int push_waiters;
+    /* times a sleeping thread was woken (to spot herds) */
+    uint64_t stat_wakeups;
+
 } nitro_queue_t;
 
 nitro_queue_t *nitro_queue_new(int capacity,
                                nitro_queue_state_changed queue_cb, void *baton);
+nitro_queue_t *nitro_queue_new_ring(int capacity,
+                                    nitro_queue_state_changed queue_cb, void *baton);
+
+void nitro_queue_set_byte_capacity(nitro_queue_t *q, size_t byte_capacity);
+void nitro_queue_set_spill(nitro_queue_t *q, const char *dir);
+int nitro_queue_full(nitro_queue_t *q);
 
 nitro_frame_t *nitro_queue_pull(nitro_queue_t *q, int wait);
+nitro_frame_t *nitro_queue_pull_timeout(nitro_queue_t *q, double timeout);
+int nitro_queue_pull_batch(nitro_queue_t *q,
+                           nitro_frame_t **frames, int max, int wait);
+int nitro_queue_pull_batch_timeout(nitro_queue_t *q,
+                                   nitro_frame_t **frames, int max, double timeout);
 int nitro_queue_push(nitro_queue_t *q, nitro_frame_t *f,
                      int wait);
+int nitro_queue_push_timeout(nitro_queue_t *q, nitro_frame_t *f,
+                             double timeout);
+int nitro_queue_push_batch(nitro_queue_t *q,
+                           nitro_frame_t **frames, int n, int wait);
+int nitro_queue_push_batch_timeout(nitro_queue_t *q,
+                                   nitro_frame_t **frames, int n, double timeout);
 int nitro_queue_fd_write(nitro_queue_t *q, int fd,
                          nitro_frame_t *partial,
                          nitro_frame_t **remain,
@@ -101,6 +157,12 @@ inline int nitro_queue_count(
     return q->count;
 }
 
+/* not tracked by ring queues, which only take a frame limit */
+inline size_t nitro_queue_bytes(
+    nitro_queue_t *q) {
+    return q->bytes;
+}
+
 typedef nitro_frame_t *(*nitro_queue_frame_generator)(void *baton);
 void nitro_queue_move(nitro_queue_t *src, nitro_queue_t *dst);
 
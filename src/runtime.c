@@ -40,63 +40,311 @@
 #include "runtime.h"
 #include "socket.h"
 
-nitro_runtime *the_runtime;
+nitro_runtime_t *the_runtime;
+
+/* every live runtime (for stats) */
+nitro_runtime_t *nitro_runtime_list;
+pthread_mutex_t l_runtime_list = PTHREAD_MUTEX_INITIALIZER;
+static int runtime_ids;
+
+/* which loop (if any) the calling thread is running */
+static pthread_key_t loop_key;
 
 void handle_pipe(int sig) {
     /* NOOP - writev will ignore the EINT */
 }
 
-static void *actual_run(void *unused) {
+static void *actual_run(void *p) {
+    nitro_loop_t *l = (nitro_loop_t *)p;
+    pthread_setspecific(loop_key, l);
 
     // handle everything!
-    ev_run(the_runtime->the_loop, 0);
+    ev_run(l->the_loop, 0);
 
     // we ended?  clean up
-    ev_async_stop(the_runtime->the_loop, &the_runtime->thread_wake);
+    ev_async_stop(l->the_loop, &l->thread_wake);
 
-    ev_loop_destroy(the_runtime->the_loop);
+    ev_loop_destroy(l->the_loop);
+    nitro_async_ring_destroy(&l->async_ring);
     return NULL;
 }
 
+/*
+ * nitro_runtime_drain_cb
+ * ----------------------
+ *
+ * Embedded mode: commands the loop thread schedules for itself
+ * skip the ev_async wakeup, so run them right before the loop
+ * blocks.
+ */
+static void nitro_runtime_drain_cb(struct ev_loop *loop, ev_prepare *prep, int revents) {
+    nitro_loop_t *l = (nitro_loop_t *)prep->data;
+    nitro_async_cb(loop, &l->thread_wake, 0);
+}
+
+static void nitro_runtime_limit_cb(struct ev_loop *loop, ev_timer *limit, int revents) {
+    /* NOOP - only here to end ev_run */
+}
+
+static void nitro_loop_init(nitro_loop_t *l, int index, struct ev_loop *loop) {
+    l->index = index;
+    l->the_loop = loop;
+    nitro_async_ring_init(&l->async_ring);
+
+    ev_async_init(&l->thread_wake, nitro_async_cb);
+    l->thread_wake.data = l;
+    ev_async_start(l->the_loop, &l->thread_wake);
+}
+
+/*
+ * nitro_runtime_alloc
+ * -------------------
+ *
+ * Create a runtime with `num_loops` (not yet started) loops.
+ * Process-wide state is set up by the first runtime, and torn
+ * down by the last one (see nitro_runtime_free).
+ */
+static nitro_runtime_t *nitro_runtime_alloc(int num_loops) {
+    nitro_runtime_t *rt;
+
+    pthread_mutex_lock(&l_runtime_list);
+
+    if (!nitro_runtime_list) {
+        nitro_err_start();
+        sodium_init();
+        pthread_key_create(&loop_key, NULL);
+        signal(SIGPIPE, handle_pipe); /* ignore sigpipe */
+    }
+
+    ZALLOC(rt);
+    rt->id = runtime_ids++;
+    DL_APPEND(nitro_runtime_list, rt);
+    pthread_mutex_unlock(&l_runtime_list);
+
+    pthread_mutex_init(&rt->l_inproc, NULL);
+    pthread_mutex_init(&rt->l_socks, NULL);
+
+    rt->num_sock = 0;
+
+    rt->random_fd = open("/dev/urandom", O_RDONLY);
+
+    rt->num_loops = num_loops;
+    rt->loops = calloc(num_loops, sizeof(nitro_loop_t));
+
+    return rt;
+}
+
+static void nitro_runtime_free(nitro_runtime_t *rt) {
+    close(rt->random_fd);
+    free(rt->loops);
+    pthread_mutex_destroy(&rt->l_inproc);
+    pthread_mutex_destroy(&rt->l_socks);
+
+    pthread_mutex_lock(&l_runtime_list);
+    DL_DELETE(nitro_runtime_list, rt);
+
+    if (!nitro_runtime_list) {
+        pthread_key_delete(loop_key);
+        nitro_err_stop();
+    }
+
+    pthread_mutex_unlock(&l_runtime_list);
+    free(rt);
+}
+
+/*
+ * nitro_runtime_new
+ * -----------------
+ *
+ * Create an independent runtime running `num_threads` loops,
+ * each on its own thread.  Sockets created on it (see
+ * nitro_runtime_socket_bind/connect) share nothing with other
+ * runtimes: not threads, not the inproc namespace, not stats.
+ */
+nitro_runtime_t *nitro_runtime_new(int num_threads) {
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    nitro_runtime_t *rt = nitro_runtime_alloc(num_threads);
+    int i;
+
+    for (i = 0; i < num_threads; i++) {
+        nitro_loop_t *l = &rt->loops[i];
+        nitro_loop_init(l, i, ev_loop_new(0)); // AUTO backend
+        l->owns_loop = 1;
+        pthread_create(&l->the_thread, NULL, actual_run, l);
+    }
+
+    return rt;
+}
+
+/*
+ * nitro_runtime_destroy
+ * ---------------------
+ *
+ * Stop a runtime's loops and free it.  All of its sockets must
+ * already be closed and destroyed.
+ */
+void nitro_runtime_destroy(nitro_runtime_t *rt) {
+    assert(rt->num_sock == 0);
+    int i;
+
+    nitro_loop_t *l = &rt->loops[0];
+
+    if (l->embedded) {
+        NITRO_THREAD_CHECK(l);
+        ev_prepare_stop(l->the_loop, &l->drain);
+        ev_async_stop(l->the_loop, &l->thread_wake);
+        nitro_async_cb(l->the_loop, &l->thread_wake, 0);
+
+        if (l->owns_loop) {
+            ev_loop_destroy(l->the_loop);
+        }
+
+        nitro_async_ring_destroy(&l->async_ring);
+        nitro_runtime_free(rt);
+        return;
+    }
+
+    for (i = 0; i < rt->num_loops; i++) {
+        nitro_async_t a = {NITRO_ASYNC_DIE};
+        nitro_async_schedule(&a, &rt->loops[i]);
+    }
+
+    for (i = 0; i < rt->num_loops; i++) {
+        void *res;
+        pthread_join(rt->loops[i].the_thread, &res);
+    }
+
+    nitro_runtime_free(rt);
+}
+
 int nitro_runtime_start() {
+    return nitro_runtime_start_threads(1);
+}
 
+int nitro_runtime_start_threads(int num_threads) {
     if (the_runtime) {
         return NITRO_ERR_ALREADY_RUNNING;
     }
 
-    nitro_err_start();
-    sodium_init();
+    the_runtime = nitro_runtime_new(num_threads);
+    return 0;
+}
+
+/*
+ * nitro_runtime_start_embedded
+ * ----------------------------
+ *
+ * Start the runtime without any nitro thread.  The calling
+ * thread owns the (single) loop and must drive it, either with
+ * nitro_runtime_run_once() or by running `loop` itself.
+ */
+int nitro_runtime_start_embedded(struct ev_loop *loop) {
+    if (the_runtime) {
+        return NITRO_ERR_ALREADY_RUNNING;
+    }
+
+    nitro_runtime_t *rt = nitro_runtime_alloc(1);
+
+    nitro_loop_t *l = &rt->loops[0];
+    l->owns_loop = !loop;
+    nitro_loop_init(l, 0, loop ? loop : ev_loop_new(0));
+    l->embedded = 1;
+    l->the_thread = pthread_self();
+    pthread_setspecific(loop_key, l);
+
+    ev_prepare_init(&l->drain, nitro_runtime_drain_cb);
+    l->drain.data = l;
+    ev_prepare_start(l->the_loop, &l->drain);
+
+    the_runtime = rt;
+    return 0;
+}
+
+/*
+ * nitro_runtime_run_once
+ * ----------------------
+ *
+ * Embedded mode: run one iteration of the loop, waiting at most
+ * `timeout` seconds for something to happen (< 0 waits until
+ * something does, 0 does not wait at all).
+ *
+ * The calling thread becomes the loop's thread.
+ */
+int nitro_runtime_run_once(double timeout) {
+    if (!the_runtime) {
+        return NITRO_ERR_NOT_RUNNING;
+    }
+
+    nitro_loop_t *l = &the_runtime->loops[0];
 
-    ZALLOC(the_runtime);
-    signal(SIGPIPE, handle_pipe); /* ignore sigpipe */
-    the_runtime->the_loop = ev_loop_new(0); // AUTO backend
-    pthread_mutex_init(&the_runtime->l_inproc, NULL);
-    pthread_mutex_init(&the_runtime->l_async, NULL);
-    pthread_mutex_init(&the_runtime->l_socks, NULL);
+    if (!l->embedded) {
+        return NITRO_ERR_NOT_EMBEDDED;
+    }
 
-    the_runtime->num_sock = 0;
+    l->the_thread = pthread_self();
+    pthread_setspecific(loop_key, l);
 
-    the_runtime->random_fd = open("/dev/urandom", O_RDONLY);
+    if (timeout == 0) {
+        ev_run(l->the_loop, EVRUN_NOWAIT);
+    } else if (timeout < 0) {
+        ev_run(l->the_loop, EVRUN_ONCE);
+    } else {
+        /* just there to bound the wait */
+        ev_timer limit;
+        ev_timer_init(&limit, nitro_runtime_limit_cb, timeout, 0);
+        ev_timer_start(l->the_loop, &limit);
+        ev_run(l->the_loop, EVRUN_ONCE);
+        ev_timer_stop(l->the_loop, &limit);
+    }
 
-    ev_async_init(&the_runtime->thread_wake, nitro_async_cb);
-    ev_async_start(the_runtime->the_loop, &the_runtime->thread_wake);
-    pthread_create(&the_runtime->the_thread, NULL, actual_run, NULL);
     return 0;
 }
 
+/*
+ * nitro_runtime_ev_loop
+ * ---------------------
+ *
+ * The libev loop used by an embedded runtime (NULL otherwise).
+ */
+struct ev_loop *nitro_runtime_ev_loop() {
+    if (!the_runtime || !the_runtime->loops[0].embedded) {
+        return NULL;
+    }
+
+    return the_runtime->loops[0].the_loop;
+}
+
+/*
+ * nitro_runtime_next_loop
+ * -----------------------
+ *
+ * Pick the loop that should own the next socket or pipe (round robin).
+ */
+nitro_loop_t *nitro_runtime_next_loop(nitro_runtime_t *rt) {
+    unsigned int n = __sync_fetch_and_add(&rt->next_loop, 1);
+    return &rt->loops[n % rt->num_loops];
+}
+
+/*
+ * nitro_runtime_current_loop
+ * --------------------------
+ *
+ * The loop running on the calling thread, or NULL if this
+ * is not a nitro thread.
+ */
+nitro_loop_t *nitro_runtime_current_loop() {
+    return (nitro_loop_t *)pthread_getspecific(loop_key);
+}
+
 int nitro_runtime_stop() {
     if (!the_runtime) {
         return NITRO_ERR_NOT_RUNNING;
     }
 
-    assert(the_runtime->num_sock == 0);
-    nitro_async_t *a = nitro_async_new(NITRO_ASYNC_DIE);
-    nitro_async_schedule(a);
-    void *res;
-    pthread_join(the_runtime->the_thread, &res);
-    close(the_runtime->random_fd);
-    free(the_runtime);
+    nitro_runtime_destroy(the_runtime);
     the_runtime = NULL;
-    nitro_err_stop();
     return 0;
 }
@@ -38,12 +38,29 @@
 #include "common.h"
 #include "async.h"
 
-typedef struct nitro_runtime {
+/* One libev event loop and the thread that runs it */
+typedef struct nitro_loop_t {
     struct ev_loop *the_loop;
     pthread_t the_thread;
 
-    nitro_async_t *async_queue;
-    pthread_mutex_t l_async;
+    nitro_async_ring async_ring;
+
+    ev_async thread_wake;
+    /* embedded mode only: runs commands queued by the loop's own thread */
+    ev_prepare drain;
+
+    int index;
+    /* driven by the application, not a nitro thread */
+    int embedded;
+    /* the_loop was created by nitro (and must be destroyed by it) */
+    int owns_loop;
+} nitro_loop_t;
+
+typedef struct nitro_runtime_t {
+    /* Event loops; pipes are spread across these */
+    nitro_loop_t *loops;
+    int num_loops;
+    unsigned int next_loop;
 
     pthread_mutex_t l_inproc;
     nitro_inproc_socket_t *inprocs;
@@ -51,20 +68,33 @@ typedef struct nitro_runtime {
     pthread_mutex_t l_socks;
     nitro_socket_t *socks;
 
-    ev_async thread_wake;
-
     int random_fd;
 
     int num_sock;
-} nitro_runtime;
+    int id;
+
+    struct nitro_runtime_t *prev;
+    struct nitro_runtime_t *next;
+} nitro_runtime_t;
 
-extern nitro_runtime *the_runtime;
+/* The runtime used by nitro_runtime_start/nitro_socket_bind/etc */
+extern nitro_runtime_t *the_runtime;
+extern nitro_runtime_t *nitro_runtime_list;
+extern pthread_mutex_t l_runtime_list;
 
 int nitro_runtime_start();
+int nitro_runtime_start_threads(int num_threads);
+int nitro_runtime_start_embedded(struct ev_loop *loop);
+int nitro_runtime_run_once(double timeout);
+struct ev_loop *nitro_runtime_ev_loop();
 int nitro_runtime_stop();
+nitro_runtime_t *nitro_runtime_new(int num_threads);
+void nitro_runtime_destroy(nitro_runtime_t *rt);
+nitro_loop_t *nitro_runtime_next_loop(nitro_runtime_t *rt);
+nitro_loop_t *nitro_runtime_current_loop();
 
-#define NITRO_THREAD_CHECK {\
-        assert(pthread_equal(pthread_self(), the_runtime->the_thread));\
+#define NITRO_THREAD_CHECK(l) {\
+        assert(pthread_equal(pthread_self(), (l)->the_thread));\
     }
 
 #endif /* RUNTIME_H */
@@ -37,13 +37,14 @@
 #include "runtime.h"
 #include "crypto.h"
 
-nitro_socket_t *nitro_socket_new(nitro_sockopt_t *opt) {
+nitro_socket_t *nitro_socket_new(nitro_runtime_t *rt, nitro_sockopt_t *opt) {
     nitro_socket_t *sock;
     ZALLOC(sock);
 
     nitro_universal_socket_t *us = &sock->stype.univ;
     opt = opt ? opt : nitro_sockopt_new();
     us->opt = opt;
+    us->runtime = rt;
 
     if (!us->opt->has_ident) {
         crypto_make_keypair(us->opt->ident, us->opt->pkey);
@@ -80,13 +81,46 @@ nitro_socket_t *nitro_socket_new(nitro_sockopt_t *opt) {
 
     pthread_mutex_init(&us->l_stats, NULL);
 
-    pthread_mutex_lock(&the_runtime->l_socks);
-    DL_APPEND(the_runtime->socks, sock);
-    __sync_fetch_and_add(&the_runtime->num_sock, 1);
-    pthread_mutex_unlock(&the_runtime->l_socks);
+    pthread_mutex_lock(&rt->l_socks);
+    DL_APPEND(rt->socks, sock);
+    __sync_fetch_and_add(&rt->num_sock, 1);
+    pthread_mutex_unlock(&rt->l_socks);
     return sock;
 }
 
+/* A socket queue with the given frame and byte limits; bounded
+   queues use the lock-free ring if asked, unless they need
+   byte accounting or a spill file (if `spill` and the options
+   have a spill dir), which only the locked queue does.
+   Expired frames it drops are counted in `expired` */
+nitro_queue_t *nitro_socket_queue_new(nitro_sockopt_t *opt,
+                                      int capacity, size_t byte_capacity, int spill, uint64_t *expired,
+                                      nitro_queue_state_changed cb, void *baton) {
+    nitro_queue_t *q;
+    int bounded = capacity > 0 || byte_capacity;
+    spill = spill && opt->spill_dir && bounded;
+
+    if (opt->ring_queues && !byte_capacity && !spill) {
+        q = nitro_queue_new_ring(capacity, cb, baton);
+    } else {
+        q = nitro_queue_new(capacity, cb, baton);
+        nitro_queue_set_byte_capacity(q, byte_capacity);
+
+        if (spill) {
+            nitro_queue_set_spill(q, opt->spill_dir);
+        }
+    }
+
+    q->stat_expired = expired;
+    return q;
+}
+
+/* Frames the socket dropped, sending or receiving, for
+   being past their deadline */
+uint64_t nitro_socket_expired(nitro_socket_t *s) {
+    return __sync_fetch_and_add(&s->stype.univ.stat_expired, 0);
+}
+
 NITRO_SOCKET_TRANSPORT socket_parse_location(char *location, char **next) {
     if (!strncmp(location, TCP_PREFIX, strlen(TCP_PREFIX))) {
         *next = location + strlen(TCP_PREFIX);
@@ -103,13 +137,15 @@ NITRO_SOCKET_TRANSPORT socket_parse_location(char *location, char **next) {
 }
 
 void nitro_socket_destroy(nitro_socket_t *s) {
-    pthread_mutex_lock(&the_runtime->l_socks);
-    DL_DELETE(the_runtime->socks, s);
-    pthread_mutex_unlock(&the_runtime->l_socks);
-
     nitro_universal_socket_t *us = &s->stype.univ;
+    nitro_runtime_t *rt = us->runtime;
+
+    pthread_mutex_lock(&rt->l_socks);
+    DL_DELETE(rt->socks, s);
+    pthread_mutex_unlock(&rt->l_socks);
+
     nitro_sockopt_destroy(us->opt);
     free(us->given_location);
     free(s);
-    __sync_fetch_and_sub(&the_runtime->num_sock, 1);
+    __sync_fetch_and_sub(&rt->num_sock, 1);
 }
@@ -46,6 +46,17 @@
 
 typedef struct nitro_pipe_t *nitro_pipe_t_p;
 
+struct nitro_loop_t;
+
+/* A buffer of received bytes, the pipe's reference to it
+   (frames parsed from it take their own), and where its
+   unparsed bytes start */
+typedef struct nitro_pipe_input_t {
+    nitro_buffer_t *buf;
+    nitro_counted_buffer_t *cbuf;
+    int start;
+} nitro_pipe_input_t;
+
 typedef struct nitro_pipe_t {
 
     /* Direct send queue */
@@ -55,11 +66,18 @@ typedef struct nitro_pipe_t {
     ev_io ior;
     ev_io iow;
     int fd;
+    /* event loop that owns this pipe's watchers */
+    struct nitro_loop_t *loop;
     uint64_t sub_state_sent;
     uint64_t sub_state_recv;
 
     /* When we have partial output */
     nitro_frame_t *partial;
+    /* frames unpacked from a BATCH packet but not yet
+       queued (the recv queue filled up) */
+    nitro_frame_t *batch[NITRO_FRAME_BATCH_MAX];
+    int batch_next;
+    int batch_count;
     uint8_t *remote_ident;
     nitro_counted_buffer_t *remote_ident_buf;
     char us_handshake;
@@ -69,7 +87,12 @@ typedef struct nitro_pipe_t {
     uint8_t nonce_gen[crypto_box_NONCEBYTES];
     uint64_t *nonce_incr;
 
-    nitro_buffer_t *in_buffer;
+    /* an ENABLE_WRITES for this pipe is already queued */
+    int write_wake_pending;
+
+    /* Received bytes: a receive segment, or a buffer sized
+       for one large frame */
+    nitro_pipe_input_t in;
 
     void *the_socket;
 
@@ -81,6 +104,7 @@ typedef struct nitro_pipe_t {
     uint64_t stat_direct;
     uint64_t bytes_sent;
     uint64_t bytes_recv;
+    uint64_t stat_wakes_coalesced;
     double born;
 
     char remote_location[50];
@@ -126,10 +150,14 @@ typedef enum {
     int write_pipe;\
     /* Parent socket */\
     void *parent;\
+    /* Runtime this socket belongs to */\
+    struct nitro_runtime_t *runtime;\
     /* Subscription trie */\
     nitro_prefix_trie_node *subs;\
     /* Stats lock (for 32 bit systems) */\
     pthread_mutex_t l_stats;\
+    /* Frames dropped for missing their deadline */\
+    uint64_t stat_expired;\
     /* Local "want subscription" list */\
     nitro_key_t *sub_keys;\
      
@@ -147,6 +175,20 @@ typedef struct nitro_tcp_socket_t {
     nitro_queue_t *q_empty;
     ev_timer close_timer;
 
+    /* event loop that owns the socket's own watchers
+       (bind, connect, timers); pipes may live on any loop */
+    struct nitro_loop_t *loop;
+    /* loops still closing their pipes during shutdown */
+    int closing_loops;
+    /* set (under l_schedule) before CLOSE_PIPES is queued;
+       no socket-wide command may be queued after that, or it
+       could run once the socket is freed */
+    int closing;
+    pthread_mutex_t l_schedule;
+    /* per-loop: an ENABLE_WRITES/ENABLE_READS is already queued */
+    int *write_wake_pending;
+    int *read_wake_pending;
+
     /* Pipes need to be locked during map
        lookup, mutation by libev thread, etc */
     pthread_mutex_t l_pipes;
@@ -178,6 +220,7 @@ typedef struct nitro_tcp_socket_t {
     uint64_t stat_sent;
     uint64_t stat_recv;
     uint64_t stat_direct;
+    uint64_t stat_wakes_coalesced;
 } nitro_tcp_socket_t;
 
 typedef struct nitro_inproc_socket_t {
@@ -219,10 +262,20 @@ typedef struct nitro_socket_t {
 
 } nitro_socket_t;
 
-nitro_socket_t *nitro_socket_new();
+struct nitro_runtime_t;
+
+nitro_socket_t *nitro_socket_new(struct nitro_runtime_t *rt, nitro_sockopt_t *opt);
 void nitro_socket_destroy();
+nitro_queue_t *nitro_socket_queue_new(nitro_sockopt_t *opt,
+                                      int capacity, size_t byte_capacity, int spill, uint64_t *expired,
+                                      nitro_queue_state_changed cb, void *baton);
+uint64_t nitro_socket_expired(nitro_socket_t *s);
 nitro_socket_t *nitro_socket_bind(char *location, nitro_sockopt_t *opt);
 nitro_socket_t *nitro_socket_connect(char *location, nitro_sockopt_t *opt);
+nitro_socket_t *nitro_runtime_socket_bind(struct nitro_runtime_t *rt,
+        char *location, nitro_sockopt_t *opt);
+nitro_socket_t *nitro_runtime_socket_connect(struct nitro_runtime_t *rt,
+        char *location, nitro_sockopt_t *opt);
 void nitro_socket_close(nitro_socket_t *s);
 NITRO_SOCKET_TRANSPORT socket_parse_location(char *location, char **next);
 
@@ -0,0 +1,312 @@
+/*
+ * Nitro
+ *
+ * spill.c - Overflow for bounded send queues, kept in a
+ *           file rather than on the heap
+ *
+ *  -- LICENSE --
+ *
+ * Copyright 2013 Bump Technologies, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BUMP TECHNOLOGIES, INC. ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP TECHNOLOGIES, INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of Bump Technologies, Inc.
+ *
+ */
+
+#include "spill.h"
+#include "err.h"
+
+#include <fcntl.h>
+
+extern inline int nitro_spill_count(nitro_spill_t *sp);
+
+/* Each frame is stored as a record header followed by
+   its wire bytes (protocol header, data, ident stack) */
+typedef struct nitro_spill_record {
+    uint32_t length;
+    double deadline;
+} nitro_spill_record;
+
+nitro_spill_t *nitro_spill_new(const char *dir) {
+    nitro_spill_t *sp;
+    ZALLOC(sp);
+    sp->dir = strdup(dir);
+    sp->fd = -1;
+    return sp;
+}
+
+void nitro_spill_destroy(nitro_spill_t *sp) {
+    nitro_frame_t *fr;
+
+    while ((fr = nitro_spill_next(sp))) {
+        nitro_frame_destroy(fr);
+    }
+
+    if (sp->fd != -1) {
+        close(sp->fd);
+    }
+
+    free(sp->dir);
+    free(sp);
+}
+
+/*
+ * Read (or, `out`, write) `len` bytes at `pos` in the
+ * ring, in two pieces if they wrap past the end.  Records
+ * go through pread/pwrite rather than a mapping, so a full
+ * disk is an ENOSPC here instead of a SIGBUS later.
+ */
+static int nitro_spill_io(nitro_spill_t *sp, int out,
+                          uint8_t *buf, size_t len, size_t pos) {
+    while (len) {
+        pos %= sp->size;
+        size_t run = sp->size - pos < len ? sp->size - pos : len;
+        ssize_t r = out ? pwrite(sp->fd, buf, run, pos) :
+                    pread(sp->fd, buf, run, pos);
+
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (r <= 0) {
+            if (!r) {
+                errno = out ? ENOSPC : EIO;
+            }
+
+            return nitro_set_error(NITRO_ERR_ERRNO);
+        }
+
+        buf += r;
+        len -= r;
+        pos += r;
+    }
+
+    return 0;
+}
+
+/*
+ * Make the ring `size` bytes.  Records that had wrapped
+ * around the old end are copied up to follow on from it.
+ * Nothing changes unless all of that works.
+ */
+static int nitro_spill_grow(nitro_spill_t *sp, size_t size) {
+    int r = posix_fallocate(sp->fd, 0, size);
+
+    if (r) {
+        errno = r;
+        return nitro_set_error(NITRO_ERR_ERRNO);
+    }
+
+    size_t wrapped = sp->head + sp->used > sp->size ?
+                     sp->head + sp->used - sp->size : 0;
+    size_t done = 0;
+    uint8_t chunk[4096];
+
+    while (done < wrapped) {
+        size_t n = wrapped - done < sizeof(chunk) ? wrapped - done : sizeof(chunk);
+
+        if (nitro_spill_io(sp, 0, chunk, n, done) ||
+                pwrite(sp->fd, chunk, n, sp->size + done) != n) {
+            return nitro_set_error(NITRO_ERR_ERRNO);
+        }
+
+        done += n;
+    }
+
+    sp->size = size;
+    return 0;
+}
+
+/*
+ * The file is unlinked as soon as it is made, so it only
+ * takes disk space while the queue is backed up, and never
+ * outlives the process.
+ */
+static int nitro_spill_open(nitro_spill_t *sp) {
+    size_t len = strlen(sp->dir) + sizeof("/nitro-spill-XXXXXX");
+    char *path = malloc(len);
+    snprintf(path, len, "%s/nitro-spill-XXXXXX", sp->dir);
+    sp->fd = mkstemp(path);
+
+    if (sp->fd == -1) {
+        free(path);
+        return nitro_set_error(NITRO_ERR_ERRNO);
+    }
+
+    unlink(path);
+    free(path);
+
+    sp->size = 0;
+
+    if (nitro_spill_grow(sp, NITRO_SPILL_INITIAL_SZ)) {
+        close(sp->fd);
+        sp->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Append the frame, in the form it will go out on the
+ * wire.  The caller still owns `fr`.
+ *
+ * Returns 0, or -1 (NITRO_ERR_ERRNO) if the file could
+ * not be created, grown or written; then nothing was
+ * added, and the frame is the caller's to keep in memory.
+ */
+int nitro_spill_append(nitro_spill_t *sp, nitro_frame_t *fr) {
+    if (sp->fd == -1 && nitro_spill_open(sp)) {
+        return -1;
+    }
+
+    int num, i;
+    struct iovec *iovs = nitro_frame_iovs(fr, &num);
+    nitro_spill_record rec = {0, fr->deadline};
+
+    for (i = 0; i < num; i++) {
+        rec.length += iovs[i].iov_len;
+    }
+
+    size_t need = sp->used + sizeof(rec) + rec.length;
+
+    if (need > sp->size) {
+        size_t size = sp->size;
+
+        while (size < need) {
+            size <<= 1;
+        }
+
+        if (nitro_spill_grow(sp, size)) {
+            return -1;
+        }
+    }
+
+    size_t pos = sp->head + sp->used;
+
+    if (nitro_spill_io(sp, 1, (uint8_t *)&rec, sizeof(rec), pos)) {
+        return -1;
+    }
+
+    pos += sizeof(rec);
+
+    for (i = 0; i < num; i++) {
+        uint8_t *base = iovs[i].iov_base;
+        uint8_t *copy = NULL;
+
+        if (fr->file && i == 1) {
+            /* file payload; iov_base is the offset */
+            base = copy = malloc(iovs[i].iov_len);
+
+            if (pread(fr->file->fd, copy, iovs[i].iov_len,
+                      (off_t)(uintptr_t)iovs[i].iov_base) != iovs[i].iov_len) {
+                free(copy);
+                return nitro_set_error(NITRO_ERR_ERRNO);
+            }
+        }
+
+        int r = nitro_spill_io(sp, 1, base, iovs[i].iov_len, pos);
+        free(copy);
+
+        if (r) {
+            return -1;
+        }
+
+        pos += iovs[i].iov_len;
+    }
+
+    sp->used = need;
+    sp->count++;
+    return 0;
+}
+
+/* Forget everything spilled; once drained, the file is
+   cut back to its initial size so a burst doesn't pin
+   disk space */
+static void nitro_spill_reset(nitro_spill_t *sp) {
+    sp->head = sp->used = 0;
+    sp->count = 0;
+
+    if (sp->size > NITRO_SPILL_INITIAL_SZ &&
+            !ftruncate(sp->fd, NITRO_SPILL_INITIAL_SZ)) {
+        sp->size = NITRO_SPILL_INITIAL_SZ;
+    }
+}
+
+/*
+ * Pop the oldest frame, or NULL if the spill is empty.
+ * The frame owns a heap copy of the wire bytes, sent as
+ * one iovec.
+ *
+ * If the file can't be read back, what is left in it is
+ * dropped, and this returns NULL as if it were empty.
+ */
+nitro_frame_t *nitro_spill_next(nitro_spill_t *sp) {
+    if (!sp->count) {
+        return NULL;
+    }
+
+    nitro_spill_record rec;
+    uint8_t *wire = NULL;
+
+    if (nitro_spill_io(sp, 0, (uint8_t *)&rec, sizeof(rec), sp->head) ||
+            !(wire = malloc(rec.length)) ||
+            nitro_spill_io(sp, 0, wire, rec.length, sp->head + sizeof(rec))) {
+        free(wire);
+        nitro_spill_reset(sp);
+        return NULL;
+    }
+
+    sp->head = (sp->head + sizeof(rec) + rec.length) % sp->size;
+    sp->used -= sizeof(rec) + rec.length;
+
+    if (!--sp->count) {
+        nitro_spill_reset(sp);
+    }
+
+    nitro_protocol_header hd;
+    memcpy(&hd, wire, sizeof(hd));
+
+    nitro_frame_t *fr = nitro_frame_new_prealloc(
+                            wire + sizeof(hd), hd.frame_size,
+                            nitro_counted_buffer_new(wire, just_free, NULL));
+    fr->type = hd.packet_type;
+    fr->priority = hd.flags & NITRO_FRAME_PRIORITY_MASK;
+    fr->compressed = !!(hd.flags & NITRO_FRAME_COMPRESSED);
+    fr->checksum = !!(hd.flags & NITRO_FRAME_CHECKSUM);
+    fr->deadline = rec.deadline;
+
+    /* so a BATCH repacking it keeps the stack (sender included) */
+    if (hd.num_ident) {
+        nitro_frame_set_stack(fr, wire + sizeof(hd) + hd.frame_size,
+                              fr->buffer, hd.num_ident);
+    }
+
+    fr->iovs[0].iov_base = wire;
+    fr->iovs[0].iov_len = rec.length;
+    fr->iovs[1].iov_len = fr->iovs[2].iov_len = fr->iovs[3].iov_len = 0;
+    fr->iovec_set = 1;
+
+    return fr;
+}
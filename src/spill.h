@@ -0,0 +1,75 @@
+/*
+ * Nitro
+ *
+ * spill.h - Overflow for bounded send queues, kept in a
+ *           file rather than on the heap
+ *
+ *  -- LICENSE --
+ *
+ * Copyright 2013 Bump Technologies, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice, this list of
+ *       conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *       of conditions and the following disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BUMP TECHNOLOGIES, INC. ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP TECHNOLOGIES, INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those of the
+ * authors and should not be interpreted as representing official policies, either expressed
+ * or implied, of Bump Technologies, Inc.
+ *
+ */
+
+#ifndef NITRO_SPILL_H
+#define NITRO_SPILL_H
+#include "common.h"
+
+#include "frame.h"
+
+/* Spill files start this big and double as needed */
+#define NITRO_SPILL_INITIAL_SZ (1024 * 1024)
+
+/*
+ * A FIFO of serialized frames in an unlinked file under
+ * `dir`, created on the first append.  Frames are stored
+ * in wire form, so they come back ready to write.
+ *
+ * The file is a ring: records wrap around its end, and
+ * space read from the head is written again, so it only
+ * grows when more is spilled at once than it holds.
+ */
+typedef struct nitro_spill_t {
+    char *dir;
+    int fd;
+    size_t size;
+    /* file offset of the oldest record, and bytes in use
+       from there (wrapping past `size`) */
+    size_t head;
+    size_t used;
+    int count;
+} nitro_spill_t;
+
+nitro_spill_t *nitro_spill_new(const char *dir);
+void nitro_spill_destroy(nitro_spill_t *sp);
+int nitro_spill_append(nitro_spill_t *sp, nitro_frame_t *fr);
+nitro_frame_t *nitro_spill_next(nitro_spill_t *sp);
+
+inline int nitro_spill_count(nitro_spill_t *sp) {
+    return sp->count;
+}
+
+#endif /* NITRO_SPILL_H */
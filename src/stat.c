@@ -3,25 +3,55 @@
 #include "Stcp.h"
 #include "Sinproc.h"
 
+/* Bytes of TCP receive buffers kept alive by received frames,
+   and the bytes of frame data in them those frames use */
+void nitro_recv_retention(uint64_t *pinned, uint64_t *referenced) {
+    *pinned = __sync_fetch_and_add(&nitro_buffer_stat_pinned, 0);
+    *referenced = __sync_fetch_and_add(&nitro_buffer_stat_referenced, 0);
+}
+
 void stat_handle_usr1(int sig) {
-    if (the_runtime) {
-        nitro_buffer_t *buf = nitro_buffer_new();
-        char *header = "~~~ NITRO SOCKET REPORT ~~~\n";
-        nitro_buffer_append(buf, header, strlen(header));
-        pthread_mutex_lock(&the_runtime->l_socks);
+    nitro_buffer_t *buf = nitro_buffer_new();
+    char *header = "~~~ NITRO SOCKET REPORT ~~~\n";
+    nitro_buffer_append(buf, header, strlen(header));
+
+    pthread_mutex_lock(&l_runtime_list);
+    nitro_runtime_t *rt;
+    int multi = nitro_runtime_list && nitro_runtime_list->next;
+    DL_FOREACH(nitro_runtime_list, rt) {
+        if (multi) {
+            /* label each runtime's sockets */
+            int amt = 100;
+            char *ptr = nitro_buffer_prepare(buf, &amt);
+            int written = snprintf(ptr, amt, "-- runtime %d (threads=%d, sockets=%d) --\n",
+                                   rt->id, rt->num_loops, rt->num_sock);
+            nitro_buffer_extend(buf, written);
+        }
+
+        pthread_mutex_lock(&rt->l_socks);
 
         nitro_socket_t *iter;
-        DL_FOREACH(the_runtime->socks, iter) {
+        DL_FOREACH(rt->socks, iter) {
             SOCKET_CALL(iter, describe, buf);
         };
-        pthread_mutex_unlock(&the_runtime->l_socks);
-        char *footer = "~~~ END NITRO SOCKET REPORT ~~~\n";
-        nitro_buffer_append(buf, footer, strlen(footer));
-        int sz;
-        char *ptr = nitro_buffer_data(buf, &sz);
-        fwrite(ptr, sz, 1, stderr);
-        nitro_buffer_destroy(buf);
+        pthread_mutex_unlock(&rt->l_socks);
     }
+    pthread_mutex_unlock(&l_runtime_list);
+
+    uint64_t pinned, referenced;
+    nitro_recv_retention(&pinned, &referenced);
+    int amt = 100;
+    char *line = nitro_buffer_prepare(buf, &amt);
+    int written = snprintf(line, amt, "recv buffers (pinned=%" PRIu64 ", referenced=%" PRIu64 ")\n",
+                           pinned, referenced);
+    nitro_buffer_extend(buf, written);
+
+    char *footer = "~~~ END NITRO SOCKET REPORT ~~~\n";
+    nitro_buffer_append(buf, footer, strlen(footer));
+    int sz;
+    char *ptr = nitro_buffer_data(buf, &sz);
+    fwrite(ptr, sz, 1, stderr);
+    nitro_buffer_destroy(buf);
 }
 
 void stat_register_handler() {
@@ -47,5 +47,6 @@
 #endif
 
 void stat_register_handler();
+void nitro_recv_retention(uint64_t *pinned, uint64_t *referenced);
 
 #endif /* NITRO_STAT_H */
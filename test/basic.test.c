@@ -1,5 +1,6 @@
 #include "test.h"
 #include "nitro.h"
+#include "crc32c.h"
 
 static int mode;
 
@@ -157,11 +158,109 @@ void *s_2(void *p) {
     return NULL;
 }
 
+struct t_3 {
+    int got;
+    int batches;
+};
+
+void *s_3(void *p) {
+    nitro_sockopt_t *opt = nitro_sockopt_new();
+    nitro_socket_t *s = NULL;
+    switch (mode) {
+    case 0:
+        s = nitro_socket_connect("tcp://127.0.0.1:4448", opt);
+        break;
+    case 1:
+        nitro_sockopt_set_secure(opt, 1);
+        s = nitro_socket_connect("tcp://127.0.0.1:4448", opt);
+        break;
+    case 2:
+        s = nitro_socket_connect("inproc://foobar3", opt);
+        break;
+    }
+
+    int i, j;
+    nitro_frame_t *batch[100];
+
+    for (i=0; i < 10000; i += 100) {
+        for (j=0; j < 100; j++) {
+            int v = i + j;
+            batch[j] = nitro_frame_new_copy(&v, sizeof(int));
+        }
+        int sent = nitro_send_many(batch, 100, s, 0);
+        if (sent != 100 || batch[99]) {
+            break;
+        }
+    }
+
+    nitro_socket_close(s);
+
+    return NULL;
+}
+
+static int last_error;
+
+void note_error(int err, void *baton) {
+    last_error = err;
+}
+
+/* a raw connection that says HELLO as `ident`, to send
+   hand made packets to a tcp socket */
+static int raw_connect(int port, char *ident) {
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct timeval wait = {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        return -1;
+    }
+
+    nitro_protocol_header hd = {1, NITRO_FRAME_HELLO, 0, 0,
+        SOCKET_IDENT_LENGTH};
+    char hello[sizeof(hd) + SOCKET_IDENT_LENGTH];
+    memcpy(hello, &hd, sizeof(hd));
+    memset(hello + sizeof(hd), *ident, SOCKET_IDENT_LENGTH);
+    return write(fd, hello, sizeof(hello)) == sizeof(hello) ? fd : -1;
+}
+
+/* a DATA packet with a CRC32C trailer, damaged if asked */
+static int raw_send_checksummed(int fd, char *body, int damage) {
+    char pkt[sizeof(nitro_protocol_header) + 64 + sizeof(uint32_t)];
+    int len = strlen(body) + 1;
+    nitro_protocol_header hd = {1, NITRO_FRAME_DATA, 0,
+        NITRO_FRAME_CHECKSUM, len};
+    memcpy(pkt, &hd, sizeof(hd));
+    memcpy(pkt + sizeof(hd), body, len);
+    uint32_t crc = crc32c(0, pkt, sizeof(hd) + len);
+    memcpy(pkt + sizeof(hd) + len, &crc, sizeof(crc));
+    if (damage) {
+        pkt[sizeof(hd)] ^= 0x01;
+    }
+    int total = sizeof(hd) + len + sizeof(crc);
+    return write(fd, pkt, total) == total;
+}
+
+/* every 97th frame is too big to batch */
+static int burst_fill(char *buf, int i) {
+    int len = i % 97 ? i % 64 + sizeof(int) : 500;
+    memset(buf, i, len);
+    memcpy(buf, &i, sizeof(int));
+    return len;
+}
+
 int main(int argc, char **argv) {
     if (argc > 1) {
         mode = atoi(argv[1]);
     }
-    nitro_runtime_start();
+    if (argc > 2) {
+        nitro_runtime_start_threads(atoi(argv[2]));
+    } else {
+        nitro_runtime_start();
+    }
 
     pthread_t t1, t2;
 
@@ -223,6 +322,495 @@ int main(int argc, char **argv) {
             acc2.each[i] > 0);
     }
 
+    nitro_socket_close(s);
+
+    struct t_3 acc3 = {0};
+    opt = nitro_sockopt_new();
+    switch (mode) {
+    case 0:
+        s = nitro_socket_bind("tcp://127.0.0.1:4448", opt);
+        break;
+    case 1:
+        nitro_sockopt_set_secure(opt, 1);
+        s = nitro_socket_bind("tcp://127.0.0.1:4448", opt);
+        break;
+    case 2:
+        s = nitro_socket_bind("inproc://foobar3", opt);
+        break;
+    }
+    pthread_create(&t1, NULL, s_3, NULL);
+
+    nitro_frame_t *batch[64];
+    while (acc3.got < 10000) {
+        int n = nitro_recv_many(s, batch, 64, 0);
+        int bad = 0;
+        for (i=0; i < n; i++) {
+            bad |= *(int*)nitro_frame_data(batch[i]) != acc3.got++;
+            nitro_frame_destroy(batch[i]);
+        }
+        if (bad) {
+            acc3.got = -1;
+            break;
+        }
+        ++acc3.batches;
+    }
+    pthread_join(t1, res);
+
+    TEST("r_3(send many/recv many) all 10,000 in order", acc3.got == 10000);
+    TEST("r_3(recv many) frames were batched", acc3.batches < 10000);
+
+    double d1 = now_double();
+    nitro_frame_t *none = nitro_recv_timeout(s, 0.2);
+    double d2 = now_double();
+    TEST("recv timeout gave up", none == NULL &&
+        nitro_error() == NITRO_ERR_TIMEOUT && d2 - d1 > 0.15);
+
+    /* an urgent frame overtakes the bulk already queued */
+    opt = nitro_sockopt_new();
+    nitro_socket_t *c = NULL;
+    switch (mode) {
+    case 0:
+        c = nitro_socket_connect("tcp://127.0.0.1:4448", opt);
+        break;
+    case 1:
+        nitro_sockopt_set_secure(opt, 1);
+        c = nitro_socket_connect("tcp://127.0.0.1:4448", opt);
+        break;
+    case 2:
+        c = nitro_socket_connect("inproc://foobar3", opt);
+        break;
+    }
+    for (i=0; i < 200; i++) {
+        nitro_frame_t *fr = nitro_frame_new_copy(&i, sizeof(int));
+        nitro_send(&fr, c, 0);
+    }
+    i = -1;
+    nitro_frame_t *urgent = nitro_frame_new_copy(&i, sizeof(int));
+    nitro_frame_set_priority(urgent, 3);
+    nitro_send(&urgent, c, 0);
+    sleep(1);
+
+    urgent = nitro_recv(s, 0);
+    TEST("priority frame received first",
+        *(int*)nitro_frame_data(urgent) == -1 &&
+        nitro_frame_priority(urgent) == 3);
+    nitro_frame_destroy(urgent);
+    for (i=0; i < 200; i++) {
+        nitro_frame_t *fr = nitro_recv(s, 0);
+        if (*(int*)nitro_frame_data(fr) != i || nitro_frame_priority(fr)) {
+            nitro_frame_destroy(fr);
+            break;
+        }
+        nitro_frame_destroy(fr);
+    }
+    TEST("...then the rest in order", i == 200);
+    nitro_socket_close(c);
+
+    /* frames past their deadline are dropped, not delivered:
+       on the sender while tcp has no peer, on the receiver
+       for inproc */
+    opt = nitro_sockopt_new();
+    nitro_socket_t *late = NULL;
+    switch (mode) {
+    case 0:
+        c = nitro_socket_connect("tcp://127.0.0.1:4449", opt);
+        break;
+    case 1:
+        nitro_sockopt_set_secure(opt, 1);
+        c = nitro_socket_connect("tcp://127.0.0.1:4449", opt);
+        break;
+    case 2:
+        late = nitro_socket_bind("inproc://foobar4", NULL);
+        c = nitro_socket_connect("inproc://foobar4", opt);
+        break;
+    }
+    for (i=0; i < 10; i++) {
+        nitro_frame_t *fr = nitro_frame_new_copy(&i, sizeof(int));
+        nitro_frame_set_deadline(fr, 0.05);
+        nitro_send(&fr, c, 0);
+    }
+    sleep(1);
+    if (!late) {
+        opt = nitro_sockopt_new();
+        if (mode == 1) {
+            nitro_sockopt_set_secure(opt, 1);
+        }
+        late = nitro_socket_bind("tcp://127.0.0.1:4449", opt);
+    }
+    nitro_frame_t *fresh = nitro_frame_new_copy(&i, sizeof(int));
+    nitro_send(&fresh, c, 0);
+    fresh = nitro_recv(late, 0);
+    TEST("expired frames dropped", *(int*)nitro_frame_data(fresh) == 10);
+    nitro_frame_destroy(fresh);
+    TEST("...and counted", nitro_socket_expired(mode == 2 ? late : c) == 10);
+    nitro_socket_close(c);
+    nitro_socket_close(late);
+
+    /* past the hwm, a spilling tcp socket keeps taking frames
+       while it has no peer, and delivers them all in order */
+    if (mode != 2) {
+        opt = nitro_sockopt_new();
+        nitro_sockopt_set_hwm(opt, 10);
+        nitro_sockopt_set_spill(opt, "/tmp");
+        if (mode == 1) {
+            nitro_sockopt_set_secure(opt, 1);
+        }
+        c = nitro_socket_connect("tcp://127.0.0.1:4450", opt);
+        for (i=0; i < 1000; i++) {
+            nitro_frame_t *fr = nitro_frame_new_copy(&i, sizeof(int));
+            int r = nitro_send(&fr, c, NITRO_NOWAIT);
+            if (r) {
+                break;
+            }
+        }
+        TEST("spill send never blocked", i == 1000);
+
+        opt = nitro_sockopt_new();
+        if (mode == 1) {
+            nitro_sockopt_set_secure(opt, 1);
+        }
+        late = nitro_socket_bind("tcp://127.0.0.1:4450", opt);
+        for (i=0; i < 1000; i++) {
+            nitro_frame_t *fr = nitro_recv(late, 0);
+            int v = *(int*)nitro_frame_data(fr);
+            nitro_frame_destroy(fr);
+            if (v != i) {
+                break;
+            }
+        }
+        TEST("spilled frames all delivered in order", i == 1000);
+        nitro_socket_close(c);
+        nitro_socket_close(late);
+    }
+
+    /* a header + body frame goes out without being joined */
+    opt = nitro_sockopt_new();
+    switch (mode) {
+    case 0:
+        c = nitro_socket_connect("tcp://127.0.0.1:4448", opt);
+        break;
+    case 1:
+        nitro_sockopt_set_secure(opt, 1);
+        c = nitro_socket_connect("tcp://127.0.0.1:4448", opt);
+        break;
+    case 2:
+        c = nitro_socket_connect("inproc://foobar3", opt);
+        break;
+    }
+    char body[1000];
+    memset(body, 'x', sizeof(body));
+    struct iovec segs[2] = {{"hdr:", 4}, {body, sizeof(body)}};
+    nitro_frame_t *multi = nitro_frame_new_iov(segs, 2, NULL, NULL);
+    nitro_send(&multi, c, 0);
+    multi = nitro_recv(s, 0);
+    struct iovec got[2];
+    int nsegs = nitro_frame_segments(multi, got, 2);
+    TEST("segments delivered as sent",
+        nsegs == (mode == 2 ? 2 : 1));
+    TEST("...and read back whole", nitro_frame_size(multi) == 1004 &&
+        !memcmp(nitro_frame_data(multi), "hdr:", 4) &&
+        !memcmp((char *)nitro_frame_data(multi) + 4, body, sizeof(body)));
+    nitro_frame_destroy(multi);
+
+    /* a file-backed frame arrives as the file's bytes */
+    char path[] = "/tmp/nitro-basic-XXXXXX";
+    int fd = mkstemp(path);
+    unlink(path);
+    int blob = 2 * 1024 * 1024;
+    char *want = malloc(blob);
+    for (i=0; i < blob; i++) {
+        want[i] = i * 7;
+    }
+    int wrote = write(fd, want, blob);
+    nitro_frame_t *ff = nitro_frame_new_file(fd, 1000, blob - 1000);
+    nitro_send(&ff, c, 0);
+    ff = nitro_recv(s, 0);
+    TEST("file frame delivered", wrote == blob &&
+        nitro_frame_size(ff) == blob - 1000 &&
+        !memcmp(nitro_frame_data(ff), want + 1000, blob - 1000));
+    nitro_frame_destroy(ff);
+    free(want);
+
+    /* a burst of small frames, broken up now and then by a
+       large one, goes out batched and comes back apart */
+    for (i=0; i < 1000; i++) {
+        int len = burst_fill(body, i);
+        nitro_frame_t *fr = nitro_frame_new_copy(body, len);
+        nitro_send(&fr, c, 0);
+    }
+    for (i=0; i < 1000; i++) {
+        int len = burst_fill(body, i);
+        nitro_frame_t *fr = nitro_recv(s, 0);
+        int ok = nitro_frame_size(fr) == len &&
+            !memcmp(nitro_frame_data(fr), body, len);
+        nitro_frame_destroy(fr);
+        if (!ok) {
+            break;
+        }
+    }
+    TEST("burst of small frames delivered in order", i == 1000);
+
+    /* frames either side of the receive segment size, back to
+       back, so they straddle segments and span several */
+    char *mixed = malloc(300 * 1024);
+    for (i=0; i < 300 * 1024; i++) {
+        mixed[i] = i * 13;
+    }
+    for (i=0; i < 60; i++) {
+        nitro_frame_t *fr = nitro_frame_new_copy(mixed + i,
+            (i * 40009) % (300 * 1024 - 60) + 1);
+        nitro_send(&fr, c, 0);
+    }
+    for (i=0; i < 60; i++) {
+        int len = (i * 40009) % (300 * 1024 - 60) + 1;
+        nitro_frame_t *fr = nitro_recv(s, 0);
+        int ok = nitro_frame_size(fr) == len &&
+            !memcmp(nitro_frame_data(fr), mixed + i, len);
+        nitro_frame_destroy(fr);
+        if (!ok) {
+            break;
+        }
+    }
+    TEST("frames across receive segments delivered whole", i == 60);
+    free(mixed);
+    nitro_socket_close(c);
+
+    /* with compression on, big frames go deflated and come
+       back whole; small and incompressible ones go as they are */
+    opt = nitro_sockopt_new();
+    nitro_sockopt_set_compress(opt, 256);
+    switch (mode) {
+    case 0:
+        c = nitro_socket_connect("tcp://127.0.0.1:4448", opt);
+        break;
+    case 1:
+        nitro_sockopt_set_secure(opt, 1);
+        c = nitro_socket_connect("tcp://127.0.0.1:4448", opt);
+        break;
+    case 2:
+        c = nitro_socket_connect("inproc://foobar3", opt);
+        break;
+    }
+    char text[20000];
+    char noise[1000];
+    for (i=0; i < sizeof(text); i++) {
+        text[i] = "{\"key\": \"value\"}, "[i % 18];
+    }
+    for (i=0; i < sizeof(noise); i++) {
+        noise[i] = random();
+    }
+    int sizes[4] = {sizeof(text), 100, sizeof(noise), 300};
+    char *bodies[4] = {text, text, noise, text};
+    for (i=0; i < 4; i++) {
+        nitro_frame_t *fr = nitro_frame_new_copy(bodies[i], sizes[i]);
+        nitro_frame_set_priority(fr, 1);
+        nitro_send(&fr, c, 0);
+    }
+    for (i=0; i < 4; i++) {
+        nitro_frame_t *fr = nitro_recv(s, 0);
+        int ok = nitro_frame_size(fr) == sizes[i] &&
+            nitro_frame_priority(fr) == 1 &&
+            !memcmp(nitro_frame_data(fr), bodies[i], sizes[i]);
+        nitro_frame_destroy(fr);
+        if (!ok) {
+            break;
+        }
+    }
+    TEST("compressed frames delivered whole", i == 4);
+    nitro_socket_close(c);
+
+    /* with checksums on, small (batched) and big (reused)
+       frames all arrive intact */
+    opt = nitro_sockopt_new();
+    nitro_sockopt_set_checksum(opt, 1);
+    switch (mode) {
+    case 0:
+        c = nitro_socket_connect("tcp://127.0.0.1:4448", opt);
+        break;
+    case 1:
+        nitro_sockopt_set_secure(opt, 1);
+        c = nitro_socket_connect("tcp://127.0.0.1:4448", opt);
+        break;
+    case 2:
+        c = nitro_socket_connect("inproc://foobar3", opt);
+        break;
+    }
+    for (i=0; i < 500; i++) {
+        int len = burst_fill(body, i);
+        nitro_frame_t *fr = nitro_frame_new_copy(body, len);
+        nitro_send(&fr, c, 0);
+    }
+    nitro_frame_t *reused = nitro_frame_new_copy(text, sizeof(text));
+    nitro_send(&reused, c, NITRO_REUSE);
+    for (i=0; i < 500; i++) {
+        int len = burst_fill(body, i);
+        nitro_frame_t *fr = nitro_recv(s, 0);
+        int ok = nitro_frame_size(fr) == len &&
+            !memcmp(nitro_frame_data(fr), body, len);
+        nitro_frame_destroy(fr);
+        if (!ok) {
+            break;
+        }
+    }
+    nitro_frame_t *back = nitro_recv(s, 0);
+    TEST("checksummed frames delivered in order", i == 500 &&
+        nitro_frame_size(back) == sizeof(text) &&
+        !memcmp(nitro_frame_data(back), text, sizeof(text)));
+    nitro_frame_destroy(back);
+    nitro_frame_destroy(reused);
+    nitro_socket_close(c);
+
+    if (mode == 0) {
+        /* a frame damaged in transit is refused, and the
+           connection dropped */
+        opt = nitro_sockopt_new();
+        nitro_sockopt_set_error_handler(opt, note_error, NULL);
+        nitro_socket_t *guard = nitro_socket_bind("tcp://127.0.0.1:4451", opt);
+        sleep(1);
+        int fd = raw_connect(4451, "r");
+        raw_send_checksummed(fd, "intact", 0);
+        nitro_frame_t *fr = nitro_recv(guard, 0);
+        TEST("checksum verified on receipt",
+            !strcmp(nitro_frame_data(fr), "intact"));
+        nitro_frame_destroy(fr);
+        raw_send_checksummed(fd, "damaged", 1);
+        fr = nitro_recv_timeout(guard, 0.5);
+        char drain[64];
+        while (read(fd, drain, sizeof(drain)) > 0) {
+        }
+        TEST("damaged frame refused", fr == NULL &&
+            last_error == NITRO_ERR_BAD_CHECKSUM);
+        close(fd);
+        nitro_socket_close(guard);
+
+        /* received frames keep their receive buffer alive,
+           unless copy_below has them copied out */
+        opt = nitro_sockopt_new();
+        nitro_sockopt_set_copy_below(opt, 2048);
+        nitro_socket_t *keep = nitro_socket_bind("tcp://127.0.0.1:4452", NULL);
+        nitro_socket_t *copy = nitro_socket_bind("tcp://127.0.0.1:4453", opt);
+        nitro_socket_t *to_keep = nitro_socket_connect("tcp://127.0.0.1:4452", NULL);
+        nitro_socket_t *to_copy = nitro_socket_connect("tcp://127.0.0.1:4453", NULL);
+        nitro_frame_t *held[10];
+        uint64_t pinned0, ref0, pinned, ref;
+        nitro_recv_retention(&pinned0, &ref0);
+        for (i=0; i < 10; i++) {
+            nitro_frame_t *fr = nitro_frame_new_copy(body, 1000);
+            nitro_send(&fr, to_keep, 0);
+        }
+        for (i=0; i < 10; i++) {
+            held[i] = nitro_recv(keep, 0);
+        }
+        nitro_recv_retention(&pinned, &ref);
+        TEST("shared frames counted as pinning their buffer",
+            ref - ref0 == 10000 && pinned > pinned0);
+        for (i=0; i < 10; i++) {
+            nitro_frame_destroy(held[i]);
+        }
+        nitro_recv_retention(&pinned, &ref);
+        TEST("...and let it go when destroyed", ref == ref0);
+        for (i=0; i < 10; i++) {
+            nitro_frame_t *fr = nitro_frame_new_copy(body, 1000);
+            nitro_send(&fr, to_copy, 0);
+        }
+        int intact = 1;
+        for (i=0; i < 10; i++) {
+            held[i] = nitro_recv(copy, 0);
+            intact = intact && nitro_frame_size(held[i]) == 1000 &&
+                !memcmp(nitro_frame_data(held[i]), body, 1000);
+        }
+        nitro_recv_retention(&pinned, &ref);
+        TEST("frames under copy_below copied out", intact && ref == ref0);
+        for (i=0; i < 10; i++) {
+            nitro_frame_destroy(held[i]);
+        }
+        nitro_socket_close(to_keep);
+        nitro_socket_close(to_copy);
+        nitro_socket_close(keep);
+        nitro_socket_close(copy);
+
+        /* a recv queue that is always full holds up each pipe
+           (on whichever loop) without dropping it, for frames
+           both under and over the receive segment size */
+        opt = nitro_sockopt_new();
+        nitro_sockopt_set_hwm_detail(opt, 1, 0, 0);
+        nitro_socket_t *narrow = nitro_socket_bind("tcp://127.0.0.1:4454", opt);
+        nitro_socket_t *feeds[4];
+        char *large = malloc(300 * 1024);
+        memset(large, 'l', 300 * 1024);
+        for (i=0; i < 4; i++) {
+            feeds[i] = nitro_socket_connect("tcp://127.0.0.1:4454", NULL);
+        }
+        for (i=0; i < 200; i++) {
+            int len = i % 2 ? 300 * 1024 : 100 * 1024;
+            memcpy(large, &i, sizeof(int));
+            nitro_frame_t *fr = nitro_frame_new_copy(large, len);
+            nitro_send(&fr, feeds[i % 4], 0);
+        }
+        int got_large = 0;
+        for (i=0; i < 200; i++) {
+            nitro_frame_t *fr = nitro_recv_timeout(narrow, 5.0);
+            if (!fr) {
+                break;
+            }
+            int v = *(int*)nitro_frame_data(fr);
+            got_large += nitro_frame_size(fr) == (v % 2 ? 300 * 1024 : 100 * 1024);
+            nitro_frame_destroy(fr);
+        }
+        TEST("full recv queue loses no frames", i == 200 && got_large == 200);
+        for (i=0; i < 4; i++) {
+            nitro_socket_close(feeds[i]);
+        }
+        nitro_socket_close(narrow);
+        free(large);
+
+        /* a queue that keeps emptying and refilling faster than
+           its loop wakes is only woken once per pending wakeup */
+        nitro_socket_t *idle = nitro_socket_connect("tcp://127.0.0.1:4456", NULL);
+        nitro_tcp_socket_t *it = &idle->stype.tcp;
+        for (i=0; i < 1000; i++) {
+            nitro_frame_t *fr = nitro_frame_new_copy(&i, sizeof(int));
+            nitro_queue_push(it->q_send, fr, 0);
+            fr = nitro_queue_pull(it->q_send, 0);
+            nitro_frame_destroy(fr);
+        }
+        sleep(1);
+        int pending = 0;
+        for (i=0; i < it->runtime->num_loops; i++) {
+            pending += it->write_wake_pending[i];
+        }
+        TEST("burst of queue wakeups coalesced",
+            it->stat_wakes_coalesced > 0 && !pending);
+        nitro_socket_close(idle);
+
+        /* ...and none is lost: a burst of pubs all go out, and
+           the pipe is left with no wakeup pending */
+        nitro_socket_t *fan = nitro_socket_bind("tcp://127.0.0.1:4455", NULL);
+        nitro_socket_t *sub = nitro_socket_connect("tcp://127.0.0.1:4455", NULL);
+        nitro_sub(sub, (uint8_t *)"w", 1);
+        sleep(1);
+        for (i=0; i < 10000; i++) {
+            nitro_frame_t *fr = nitro_frame_new_copy(&i, sizeof(int));
+            nitro_pub(&fr, (uint8_t *)"w", 1, fan, 0);
+        }
+        for (i=0; i < 10000; i++) {
+            nitro_frame_t *fr = nitro_recv_timeout(sub, 5.0);
+            int v = fr ? *(int*)nitro_frame_data(fr) : -1;
+            if (fr) {
+                nitro_frame_destroy(fr);
+            }
+            if (v != i) {
+                break;
+            }
+        }
+        sleep(1);
+        nitro_pipe_t *fp = fan->stype.tcp.pipes;
+        TEST("burst of pubs loses no wakeup",
+            i == 10000 && fp && !fp->write_wake_pending);
+        nitro_socket_close(sub);
+        nitro_socket_close(fan);
+    }
+
     nitro_socket_close(s);
     sleep(3);
 
@@ -41,6 +41,24 @@ int main(int argc, char **argv) {
 
     nitro_buffer_destroy(buf);
 
+    buf = nitro_buffer_new_exact(40000);
+    TEST("_new_exact has just that room",
+    buf->alloc == 40000 && buf->size == 0);
+    nitro_buffer_destroy(buf);
+
+    buf = nitro_buffer_new_segment();
+    int room = 1;
+    write = nitro_buffer_prepare(buf, &room);
+    TEST("segment is fixed size",
+    buf->segment && room == NITRO_BUFFER_SEGMENT &&
+    write == buf->area && buf->alloc == NITRO_BUFFER_SEGMENT);
+    nitro_buffer_t *first = buf;
+    nitro_buffer_destroy(buf);
+    buf = nitro_buffer_new_segment();
+    TEST("segment pool reuses freed segment",
+    buf == first && buf->size == 0);
+    nitro_buffer_destroy(buf);
+
     SUMMARY(0);
     return 1;
 }
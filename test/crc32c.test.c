@@ -0,0 +1,45 @@
+#include "test.h"
+#include "crc32c.h"
+
+int main(int argc, char **argv) {
+    TEST("check value", crc32c(0, "123456789", 9) == 0xE3069283);
+    TEST("check value, by table", crc32c_sw(0, "123456789", 9) == 0xE3069283);
+    TEST("empty leaves it", crc32c(0, "", 0) == 0 &&
+        crc32c(0x1234, "", 0) == 0x1234);
+
+    /* 32 zero bytes, from RFC 3720 B.4 */
+    char zeros[32] = {0};
+    TEST("iSCSI zeros vector", crc32c(0, zeros, sizeof(zeros)) == 0x8A9136AA);
+
+    /* long enough for the interleaved streams, odd offsets
+       and lengths for the unaligned heads and tails */
+    int size = 100000;
+    uint8_t *buf = malloc(size + 8);
+    int i;
+    for (i=0; i < size + 8; i++) {
+        buf[i] = random();
+    }
+
+    int lens[] = {1, 7, 8, 63, 767, 768, 1000, 24575, 24576, 65536, size};
+    int agree = 1, off, l;
+    for (off=0; off < 8; off++) {
+        for (l=0; l < sizeof(lens) / sizeof(int); l++) {
+            agree &= crc32c(0, buf + off, lens[l]) ==
+                crc32c_sw(0, buf + off, lens[l]);
+        }
+    }
+    TEST("all paths agree", agree);
+
+    uint32_t whole = crc32c(0, buf, size);
+    uint32_t parts = crc32c(0, buf, 12345);
+    parts = crc32c(parts, buf + 12345, size - 12345);
+    TEST("extends across pieces", whole == parts);
+
+    buf[size / 2] ^= 0x10;
+    TEST("one flipped bit changes it", crc32c(0, buf, size) != whole);
+
+    free(buf);
+
+    SUMMARY(0);
+    return 1;
+}
@@ -0,0 +1,71 @@
+#include "test.h"
+#include "nitro.h"
+
+/* drive the loop until a frame shows up (or we give up) */
+static nitro_frame_t *recv_pump(nitro_socket_t *s) {
+    int i;
+
+    for (i=0; i < 10000; i++) {
+        nitro_frame_t *fr = nitro_recv(s, NITRO_NOWAIT);
+        if (fr) {
+            return fr;
+        }
+        nitro_runtime_run_once(0.01);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    TEST("run_once fails before start",
+        nitro_runtime_run_once(0) == NITRO_ERR_NOT_RUNNING);
+
+    nitro_runtime_start_embedded(NULL);
+
+    TEST("embedded loop is exposed", nitro_runtime_ev_loop() != NULL);
+
+    nitro_socket_t *r = nitro_socket_bind("tcp://127.0.0.1:4446", NULL);
+    nitro_socket_t *c = nitro_socket_connect("tcp://127.0.0.1:4446", NULL);
+
+    int i;
+
+    for (i=0; i < 1000; i++) {
+        nitro_frame_t *fr = nitro_frame_new_copy(&i, sizeof(int));
+        nitro_send(&fr, c, NITRO_NOWAIT);
+
+        fr = recv_pump(r);
+        if (!fr || *(int*)nitro_frame_data(fr) != i) {
+            break;
+        }
+
+        nitro_frame_t *back = nitro_frame_new_copy(&i, sizeof(int));
+        nitro_reply(fr, &back, r, NITRO_NOWAIT);
+        nitro_frame_destroy(fr);
+
+        fr = recv_pump(c);
+        if (!fr || *(int*)nitro_frame_data(fr) != i) {
+            break;
+        }
+        nitro_frame_destroy(fr);
+    }
+
+    TEST("1,000 round trips on one thread", i == 1000);
+
+    nitro_socket_close(r);
+    nitro_socket_close(c);
+
+    /* let the close linger run out */
+    while (the_runtime->num_sock) {
+        nitro_runtime_run_once(0.1);
+    }
+
+    TEST("stopped cleanly", nitro_runtime_stop() == 0);
+
+    nitro_runtime_start();
+    TEST("run_once fails on threaded runtime",
+        nitro_runtime_run_once(0) == NITRO_ERR_NOT_EMBEDDED);
+    nitro_runtime_stop();
+
+    SUMMARY(0);
+    return 1;
+}
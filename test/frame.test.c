@@ -1,6 +1,9 @@
 #include "test.h"
 
 #include "frame.h"
+#include "compress.h"
+#include "crc32c.h"
+#include "err.h"
 
 typedef struct frame_state {
     int done;
@@ -13,6 +16,20 @@ void my_free(void *reg, void *st) {
     free(reg);
 }
 
+#define POOL_BATCH 1000
+
+/* frames made on one thread, freed on another */
+void *destroy_batch(void *p) {
+    nitro_frame_t **frs = (nitro_frame_t **)p;
+    int i;
+
+    for (i=0; i < POOL_BATCH; i++) {
+        nitro_frame_destroy(frs[i]);
+    }
+
+    return NULL;
+}
+
 int main(int argc, char **argv) {
 
     char foo[8];
@@ -40,8 +57,16 @@ int main(int argc, char **argv) {
 
     TEST("_copy frames are different",
     fr2 != fr);
+    TEST("_copy inline data moves with the frame",
+    nitro_frame_data(fr2) == fr2->inline_data &&
+    !strcmp(nitro_frame_data(fr2), "yope"));
+
+    nitro_frame_t *big = nitro_frame_new_heap(strdup("yope"), 5);
+    nitro_frame_t *big2 = nitro_frame_copy_partial(big, NULL);
     TEST("_copy data regions are the same",
-    nitro_frame_data(fr2) == nitro_frame_data(fr));
+    nitro_frame_data(big2) == nitro_frame_data(big));
+    nitro_frame_destroy(big);
+    nitro_frame_destroy(big2);
 
     nitro_frame_destroy(fr);
     TEST("_copy data good after destroy",
@@ -144,6 +169,124 @@ int main(int argc, char **argv) {
 
     nitro_frame_destroy(fr);
 
+    frame_state segs_freed = {0};
+    struct iovec segs[3] = {{strdup("ab"), 2}, {strdup("cd"), 2},
+        {strdup("ef"), 3}};
+    fr = nitro_frame_new_iov(segs, 3, my_free, &segs_freed);
+    TEST("_new_iov size is all segments", nitro_frame_size(fr) == 7);
+    ios = nitro_frame_iovs(fr, &num);
+    TEST("_new_iov segments written in place",
+    num == 4 && ios[1].iov_base == segs[0].iov_base &&
+    ios[3].iov_base == segs[2].iov_base);
+    fr2 = nitro_frame_copy_partial(fr, NULL);
+    TEST("_new_iov data joined on demand",
+    !strcmp(nitro_frame_data(fr), "abcdef") &&
+    nitro_frame_segments(fr2, ios, 0) == 3);
+    ios = nitro_frame_iovs(fr, &num);
+    TEST("_new_iov joining leaves what is sent alone",
+    num == 4 && ios[1].iov_base == segs[0].iov_base &&
+    fr->iovec_set == 4 && !segs_freed.done &&
+    nitro_frame_data(fr) == nitro_frame_data(fr));
+    nitro_frame_destroy(fr);
+    TEST("_new_iov segments held by copy", !segs_freed.done);
+    nitro_frame_destroy(fr2);
+    TEST("_new_iov segments freed", segs_freed.done);
+
+    nitro_frame_t *few[2] = {nitro_frame_new_copy("ab", 2),
+        nitro_frame_new_copy("cde", 3)};
+    nitro_frame_set_priority(few[1], 2);
+    fr = nitro_frame_batch(few, 2);
+    nitro_batch_header bh;
+    memcpy(&bh, (char *)nitro_frame_data(fr) + 6, sizeof(bh));
+    TEST("_batch packs a header per frame",
+    fr->type == NITRO_FRAME_BATCH &&
+    nitro_frame_size(fr) == 2 * sizeof(nitro_batch_header) + 5 &&
+    bh.frame_size == 3 && bh.flags == 2 &&
+    !memcmp((char *)nitro_frame_data(fr) + 10, "cde", 3));
+    nitro_frame_destroy(fr);
+
+    int i;
+    few[1]->checksum = 1;
+    ios = nitro_frame_iovs(few[1], &num);
+    uint32_t want_crc = 0;
+    for (i=0; i < num - 1; i++) {
+        want_crc = crc32c(want_crc, ios[i].iov_base, ios[i].iov_len);
+    }
+    TEST("checksum trailer follows the packet",
+    num == 3 && (few[1]->tcp_header.flags & NITRO_FRAME_CHECKSUM) &&
+    ios[2].iov_len == sizeof(uint32_t) &&
+    *(uint32_t *)ios[2].iov_base == want_crc);
+    fr = nitro_frame_batch(few, 2);
+    memcpy(&bh, (char *)nitro_frame_data(fr) + 6, sizeof(bh));
+    TEST("_batch carries the checksum for the packet",
+    fr->checksum && !(bh.flags & NITRO_FRAME_CHECKSUM));
+    nitro_frame_destroy(few[0]);
+    nitro_frame_destroy(few[1]);
+    nitro_frame_destroy(fr);
+
+    char text[4000];
+    for (i=0; i < sizeof(text); i++) {
+        text[i] = 'a' + i % 7;
+    }
+    fr = nitro_frame_new_copy(text, sizeof(text));
+    nitro_frame_set_priority(fr, 3);
+    fr = compress_frame(fr);
+    uint32_t clear_size = 0;
+    uint8_t *clear = compress_inflate(nitro_frame_data(fr),
+        nitro_frame_size(fr), sizeof(text), &clear_size);
+    TEST("compress_frame deflates and flags it",
+    fr->compressed && nitro_frame_size(fr) < sizeof(text) / 10 &&
+    (nitro_frame_wire_flags(fr) & NITRO_FRAME_COMPRESSED) &&
+    nitro_frame_priority(fr) == 3);
+    TEST("compress_inflate restores it", clear &&
+    clear_size == sizeof(text) && !memcmp(clear, text, sizeof(text)));
+    free(clear);
+    TEST("compress_inflate refuses past max size",
+    !compress_inflate(nitro_frame_data(fr), nitro_frame_size(fr),
+        sizeof(text) - 1, &clear_size) &&
+    nitro_error() == NITRO_ERR_BAD_COMPRESSED);
+    ((uint8_t *)nitro_frame_data(fr))[8] ^= 0xff;
+    TEST("compress_inflate refuses corrupt data",
+    !compress_inflate(nitro_frame_data(fr), nitro_frame_size(fr),
+        sizeof(text), &clear_size));
+    nitro_frame_destroy(fr);
+    fr2 = nitro_frame_new_copy("abcdefgh", 8);
+    TEST("compress_frame leaves what won't shrink", compress_frame(fr2) == fr2);
+    nitro_frame_destroy(fr2);
+
+    fr = nitro_frame_new_copy("a", 2);
+    nitro_frame_incref(fr);
+    nitro_frame_destroy(fr);
+    TEST("incref keeps frame alive",
+    fr->refs == 1 && !strcmp(nitro_frame_data(fr), "a"));
+    nitro_frame_t *first = fr;
+    nitro_frame_destroy(fr);
+    fr = nitro_frame_new_copy("b", 2);
+    TEST("pool reuses freed frame", fr == first);
+    nitro_frame_destroy(fr);
+
+    nitro_frame_t *frs[POOL_BATCH];
+    uint64_t slabs = 0;
+    int round;
+
+    for (round=0; round < 20; round++) {
+        for (i=0; i < POOL_BATCH; i++) {
+            frs[i] = nitro_frame_new_copy(&i, sizeof(int));
+        }
+
+        pthread_t t;
+        void *res;
+        pthread_create(&t, NULL, destroy_batch, frs);
+        pthread_join(t, &res);
+
+        if (round == 1) {
+            slabs = nitro_frame_pool.stat_slabs;
+        }
+    }
+
+    TEST("cross-thread frees return to pool",
+    slabs > 0 && nitro_frame_pool.stat_slabs == slabs);
+
     SUMMARY(0);
     return 1;
 }
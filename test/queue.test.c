@@ -64,6 +64,7 @@ void *put_item(void *p) {
 typedef struct pipe_pass {
     char *out;
     int pread;
+    int got;
 } pipe_pass;
 
 void *pipe_consume(void *p) {
@@ -91,13 +92,101 @@ void *pipe_consume(void *p) {
             bytes += r;
             ptr += r;
         }
-    } while (r > 0 && bytes != 550000);
-    assert(bytes == 550000);
+    } while (r > 0);
+    pp->got = bytes;
 
     close(rfd);
     return NULL;
 }
 
+#define RING_THREADS 4
+#define RING_PER_THREAD 100000
+
+typedef struct ring_pass {
+    nitro_queue_t *q;
+    int id;
+    int64_t sum;
+} ring_pass;
+
+void *ring_produce(void *p) {
+    ring_pass *rp = (ring_pass *)p;
+    int i;
+
+    for (i=0; i < RING_PER_THREAD; i++) {
+        int v = rp->id * RING_PER_THREAD + i;
+        nitro_queue_push(rp->q,
+            nitro_frame_new_copy(
+            (void *)&v, sizeof(int)), 1);
+    }
+
+    return NULL;
+}
+
+void *ring_consume(void *p) {
+    ring_pass *rp = (ring_pass *)p;
+    int i;
+
+    for (i=0; i < RING_PER_THREAD; i++) {
+        nitro_frame_t *fr = nitro_queue_pull(rp->q, 1);
+        rp->sum += *((int *)nitro_frame_data(fr));
+        nitro_frame_destroy(fr);
+    }
+
+    return NULL;
+}
+
+/* Walk "dog" frames written to the wire, whether sent alone
+   or packed into BATCH packets; returns how many, or -1 */
+static int count_dogs(char *ptr, char *end, int *batches) {
+    int n = 0;
+    *batches = 0;
+
+    while (ptr + sizeof(nitro_protocol_header) <= end) {
+        nitro_protocol_header *hd = (nitro_protocol_header *)ptr;
+        char *body = ptr + sizeof(nitro_protocol_header);
+
+        if (hd->packet_type == NITRO_FRAME_DATA) {
+            if (hd->frame_size != 3 || memcmp(body, "dog", 3)) {
+                return -1;
+            }
+            ++n;
+        } else if (hd->packet_type == NITRO_FRAME_BATCH) {
+            char *rec = body;
+            nitro_batch_header bh;
+
+            while (rec < body + hd->frame_size) {
+                memcpy(&bh, rec, sizeof(bh));
+                if (bh.frame_size != 3 || bh.num_ident ||
+                        memcmp(rec + sizeof(bh), "dog", 3)) {
+                    return -1;
+                }
+                rec += sizeof(bh) + 3;
+                ++n;
+            }
+            ++(*batches);
+        } else {
+            return -1;
+        }
+
+        ptr = body + hd->frame_size;
+    }
+
+    return ptr == end ? n : -1;
+}
+
+void *ring_produce_dogs(void *p) {
+    nitro_queue_t *q = (nitro_queue_t *)p;
+    int i;
+
+    for (i=0; i < 50000; i++) {
+        nitro_queue_push(q,
+            nitro_frame_new_copy(
+                "dog", 3), 1);
+    }
+
+    return NULL;
+}
+
 static inline nitro_frame_t *make_frames(void *p) {
     int *i = (int *)p;
     if (*i == CONSUME_COUNT)
@@ -462,6 +551,157 @@ int main(int argc, char **argv) {
 
     nitro_queue_destroy(q);
 
+    /* Batches */
+    q = nitro_queue_new(5,
+    test_state_callback, &tstate);
+    nitro_frame_t *batch[8];
+    for (i=0; i < 8; i++) {
+        batch[i] = nitro_frame_new_copy(
+            (void *)&i, sizeof(int));
+    }
+    tstate.state_was = NITRO_QUEUE_STATE_EMPTY;
+    int r = nitro_queue_push_batch(q, batch, 8, 0);
+    TEST("(batch) partial accept to capacity",
+        r == 5 && nitro_queue_count(q) == 5
+        && tstate.state_was == NITRO_QUEUE_STATE_FULL);
+    r = nitro_queue_push_batch(q, batch + 5, 3, 0);
+    TEST("(batch) full queue is EAGAIN", r == -1);
+
+    r = nitro_queue_pull_batch(q, batch, 3, 0);
+    TEST("(batch) pull three",
+        r == 3 && *((int*)nitro_frame_data(batch[2])) == 2
+        && tstate.state_was == NITRO_QUEUE_STATE_CONTENTS);
+    for (i=0; i < 3; i++) {
+        nitro_frame_destroy(batch[i]);
+    }
+    r = nitro_queue_push_batch(q, batch + 5, 3, 0);
+    TEST("(batch) rest accepted",
+        r == 3 && tstate.state_was == NITRO_QUEUE_STATE_FULL);
+    r = nitro_queue_pull_batch(q, batch, 8, 0);
+    for (i=0; i < r; i++) {
+        if (*((int*)nitro_frame_data(batch[i])) != i + 3)
+            break;
+        nitro_frame_destroy(batch[i]);
+    }
+    TEST("(batch) pull drains in order",
+        r == 5 && i == 5 && tstate.state_was == NITRO_QUEUE_STATE_EMPTY);
+    r = nitro_queue_pull_batch(q, batch, 8, 0);
+    TEST("(batch) empty pull is EAGAIN", r == -1);
+    nitro_queue_destroy(q);
+
+    /* Byte limits */
+    q = nitro_queue_new(0,
+    test_state_callback, &tstate);
+    nitro_queue_set_byte_capacity(q, 10);
+    r = nitro_queue_push(q, nitro_frame_new_copy("hello", 6), 0);
+    TEST("(bytes) first frame in",
+        !r && nitro_queue_bytes(q) == 6
+        && tstate.state_was == NITRO_QUEUE_STATE_CONTENTS);
+    r = nitro_queue_push(q, nitro_frame_new_copy("world", 6), 0);
+    TEST("(bytes) frame reaching the limit is taken",
+        !r && nitro_queue_bytes(q) == 12
+        && tstate.state_was == NITRO_QUEUE_STATE_FULL);
+    hello = nitro_frame_new_copy("hello", 6);
+    r = nitro_queue_push(q, hello, 0);
+    TEST("(bytes) over the limit is EAGAIN", r == -1);
+    back = nitro_queue_pull(q, 0);
+    nitro_frame_destroy(back);
+    TEST("(bytes) pull frees bytes",
+        nitro_queue_bytes(q) == 6
+        && tstate.state_was == NITRO_QUEUE_STATE_CONTENTS);
+    r = nitro_queue_push(q, hello, 0);
+    TEST("(bytes) room again", !r && nitro_queue_count(q) == 2);
+    r = nitro_queue_pull_batch(q, batch, 8, 0);
+    for (i=0; i < r; i++) {
+        nitro_frame_destroy(batch[i]);
+    }
+    TEST("(bytes) drained",
+        r == 2 && nitro_queue_bytes(q) == 0
+        && tstate.state_was == NITRO_QUEUE_STATE_EMPTY);
+
+    /* a single frame bigger than the limit still goes through */
+    nitro_frame_t *big = nitro_frame_new_heap(malloc(100), 100);
+    r = nitro_queue_push(q, big, 0);
+    TEST("(bytes) oversized frame into empty queue",
+        !r && tstate.state_was == NITRO_QUEUE_STATE_FULL);
+    nitro_queue_destroy(q);
+
+    /* Timeouts */
+    q = nitro_queue_new(1,
+    test_state_callback, &tstate);
+    d1 = now_double();
+    back = nitro_queue_pull_timeout(q, 0.3);
+    d2 = now_double();
+    TEST("(timeout) empty pull gave up",
+        back == NULL && (d2 - d1 > 0.25) && (d2 - d1 < 1.0));
+    r = nitro_queue_push_timeout(q, nitro_frame_new_copy("hello", 6), 0.3);
+    TEST("(timeout) push with room", r == 0);
+    hello = nitro_frame_new_copy("hello", 6);
+    d1 = now_double();
+    r = nitro_queue_push_timeout(q, hello, 0.3);
+    d2 = now_double();
+    TEST("(timeout) full push gave up",
+        r == -1 && (d2 - d1 > 0.25) && (d2 - d1 < 1.0));
+    back = nitro_queue_pull_timeout(q, 0.3);
+    nitro_frame_destroy(back);
+    pthread_create(&t2, NULL, put_item, (void*)q);
+    back = nitro_queue_pull_timeout(q, 5.0);
+    TEST("(timeout) woken before deadline",
+        back && *((int*)nitro_frame_data(back)) == 1337);
+    nitro_frame_destroy(back);
+    pthread_join(t2, NULL);
+    nitro_queue_destroy(q);
+    nitro_frame_destroy(hello);
+
+    /* Priorities */
+    q = nitro_queue_new(0,
+    test_state_callback, &tstate);
+    int prios[] = {0, 0, 2, 1, 3, 0, 2};
+    int by_prio[] = {4, 2, 6, 3, 0, 1, 5};
+    /* start near the end of the array so the inserts wrap */
+    for (i=0; i < INITIAL_QUEUE_SZ - 3; i++) {
+        nitro_queue_push(q, nitro_frame_new_copy(&i, sizeof(int)), 0);
+        back = nitro_queue_pull(q, 0);
+        nitro_frame_destroy(back);
+    }
+    for (i=0; i < 7; i++) {
+        nitro_frame_t *pf = nitro_frame_new_copy(&i, sizeof(int));
+        nitro_frame_set_priority(pf, prios[i]);
+        nitro_queue_push(q, pf, 0);
+    }
+    for (i=0; i < 7; i++) {
+        back = nitro_queue_pull(q, 0);
+        int v = *(int*)nitro_frame_data(back);
+        nitro_frame_destroy(back);
+        if (v != by_prio[i]) {
+            break;
+        }
+    }
+    TEST("(priority) urgent first, in order within a priority", i == 7);
+
+    nitro_queue_t *urgent = nitro_queue_new(0, NULL, NULL);
+    for (i=0; i < 3; i++) {
+        nitro_queue_push(q, nitro_frame_new_copy(&i, sizeof(int)), 0);
+        nitro_frame_t *pf = nitro_frame_new_copy(&i, sizeof(int));
+        nitro_frame_set_priority(pf, 3);
+        nitro_queue_push(urgent, pf, 0);
+    }
+    nitro_queue_move(urgent, q);
+    r = nitro_queue_pull_batch(q, batch, 8, 0);
+    int prio_ok = r == 6;
+    for (i=0; i < r; i++) {
+        prio_ok &= nitro_frame_priority(batch[i]) == (i < 3 ? 3 : 0)
+            && *(int*)nitro_frame_data(batch[i]) == i % 3;
+        nitro_frame_destroy(batch[i]);
+    }
+    TEST("(priority) move keeps priority order", prio_ok);
+    hello = nitro_frame_new_copy("hello", 6);
+    nitro_frame_set_priority(hello, 9);
+    TEST("(priority) clamped", nitro_frame_priority(hello) == NITRO_PRIORITY_MAX);
+    nitro_frame_destroy(hello);
+    nitro_queue_destroy(urgent);
+    nitro_queue_destroy(q);
+
     void *unused;
     pthread_join(t1, &unused);
     pthread_join(t2, &unused);
@@ -513,7 +753,7 @@ int main(int argc, char **argv) {
     }
 
     int ps[2];
-    int r = pipe(ps);
+    r = pipe(ps);
     assert(!r);
 
     int pread = ps[0];
@@ -530,7 +770,7 @@ int main(int argc, char **argv) {
     nitro_frame_t *remain = NULL;
     pthread_t reader;
     char out[550000];
-    pipe_pass pp = {out, pread};
+    pipe_pass pp = {out, pread, 0};
     pthread_create(&reader, NULL, pipe_consume, &pp);
     do {
         int written;
@@ -545,36 +785,338 @@ int main(int argc, char **argv) {
         assert(bytes == 0);
     }
 
-    TEST("(fd write) correct write byte count",
-    total == 550000);
+    close(pwrite);
 
     void *t_ret;
     /* wait for reader to finish */
     pthread_join(reader, &t_ret);
 
-    char *ptr = out;
-    nitro_protocol_header target_head = {
-        1,
-        0,
-        0,
-        0,
-        3};
+    TEST("(fd write) correct write byte count",
+    total == pp.got);
 
-    for (i=0; i < 50000; i++) {
-        if (memcmp(ptr, &target_head, sizeof(target_head)) ||
-            memcmp(ptr + sizeof(target_head), "dog", 3)) {
+    int batches;
+    TEST("(fd write) read data was correct",
+    count_dogs(out, out + pp.got, &batches) == 50000);
+    TEST("(fd write) small frames went out batched",
+    batches && total < 50000 * 11);
+
+    close(pread);
+
+
+    nitro_queue_destroy(q);
+
+    /* Ring mode */
+    q = nitro_queue_new_ring(0,
+    test_state_callback, &tstate);
+    TEST("(ring) unbounded falls back", !q->ring);
+    nitro_queue_destroy(q);
+
+    tstate.got_state_change = 0;
+    q = nitro_queue_new_ring(5,
+    test_state_callback, &tstate);
+    TEST("(ring) bounded is a ring", q->ring && q->ring_mask == 7);
+
+    for (i=0; i < 5; i++) {
+        r = nitro_queue_push(q,
+            nitro_frame_new_copy(
+            (void *)&i, sizeof(int)), 0);
+        if (r)
             break;
+        if (i == 0) {
+            TEST("(ring) queue went contents",
+                tstate.got_state_change
+                && tstate.state_was == NITRO_QUEUE_STATE_CONTENTS);
         }
-        ptr += 11;
     }
+    TEST("(ring) filled to capacity", i == 5 && nitro_queue_count(q) == 5);
+    TEST("(ring) queue went full",
+        tstate.state_was == NITRO_QUEUE_STATE_FULL);
 
-    TEST("(fd write) read data was correct",
-    ptr == out + 550000);
+    hello = nitro_frame_new_copy("hello", 6);
+    r = nitro_queue_push(q, hello, 0);
+    TEST("(ring) push when full is EAGAIN",
+        r == -1);
+    nitro_frame_destroy(hello);
 
+    back = nitro_queue_pull(q, 0);
+    TEST("(ring) pull leaves full",
+        tstate.state_was == NITRO_QUEUE_STATE_CONTENTS);
+    nitro_frame_destroy(back);
+
+    for (i=1; i < 5; i++) {
+        back = nitro_queue_pull(q, 0);
+        if ( *((int*)nitro_frame_data(back)) != i)
+            break;
+        nitro_frame_destroy(back);
+    }
+    TEST("(ring) ordering", i == 5);
+    TEST("(ring) queue went empty",
+        tstate.state_was == NITRO_QUEUE_STATE_EMPTY);
+    back = nitro_queue_pull(q, 0);
+    TEST("(ring) pull when empty is EAGAIN",
+        back == NULL);
+
+    nitro_frame_t *many[8];
+    for (i=0; i < 8; i++) {
+        many[i] = nitro_frame_new_copy(
+            (void *)&i, sizeof(int));
+    }
+    tstate.got_state_change = 0;
+    r = nitro_queue_push_batch(q, many, 8, 0);
+    TEST("(ring batch) partial accept",
+        r == 5 && nitro_queue_count(q) == 5
+        && tstate.state_was == NITRO_QUEUE_STATE_FULL);
+    r = nitro_queue_push_batch(q, many + 5, 3, 0);
+    TEST("(ring batch) none fit is EAGAIN", r == -1);
+    r = nitro_queue_pull_batch(q, many, 8, 0);
+    TEST("(ring batch) pull all",
+        r == 5 && *((int*)nitro_frame_data(many[4])) == 4
+        && tstate.state_was == NITRO_QUEUE_STATE_EMPTY);
+    for (i=0; i < 8; i++) {
+        nitro_frame_destroy(many[i]);
+    }
+
+    d1 = now_double();
+    pthread_create(&t2, NULL, put_item, (void*)q);
+    back = nitro_queue_pull(q, 1);
+    d2 = now_double();
+    TEST("(ring) got blocked on empty pull",
+    (d2 - d1 > 0.7) && (d2 - d1 < 1.5)
+    && *((int*)nitro_frame_data(back)) == 1337);
+    nitro_frame_destroy(back);
+    pthread_join(t2, &unused);
+
+    d1 = now_double();
+    back = nitro_queue_pull_timeout(q, 0.3);
+    d2 = now_double();
+    TEST("(ring) empty pull timed out",
+        back == NULL && (d2 - d1 > 0.25) && (d2 - d1 < 1.0));
+
+    /* many producers, many consumers, wrapping many times */
+    nitro_queue_destroy(q);
+    q = nitro_queue_new_ring(64, NULL, NULL);
+
+    pthread_t producers[RING_THREADS];
+    pthread_t consumers[RING_THREADS];
+    ring_pass pin[RING_THREADS];
+    ring_pass pout[RING_THREADS];
+    d1 = now_double();
+    for (i=0; i < RING_THREADS; i++) {
+        pin[i].q = pout[i].q = q;
+        pin[i].id = i;
+        pout[i].sum = 0;
+        pthread_create(&producers[i], NULL, ring_produce, &pin[i]);
+        pthread_create(&consumers[i], NULL, ring_consume, &pout[i]);
+    }
+    int64_t sum = 0;
+    for (i=0; i < RING_THREADS; i++) {
+        pthread_join(producers[i], &unused);
+        pthread_join(consumers[i], &unused);
+        sum += pout[i].sum;
+    }
+    d2 = now_double();
+    int64_t n = (int64_t)RING_THREADS * RING_PER_THREAD;
+    snprintf(buf, 50, "(ring) mpmc in %.4f", d2 - d1);
+    TEST(buf, sum == n * (n - 1) / 2 && nitro_queue_count(q) == 0);
+    nitro_queue_destroy(q);
+
+    /* fd write, drained while a producer refills */
+    q = nitro_queue_new_ring(1000, NULL, NULL);
+    r = pipe(ps);
+    assert(!r);
+    pread = ps[0];
+    pwrite = ps[1];
+    r = ioctl(pread, FIONBIO, &flag);
+    assert(r == 0);
+    r = ioctl(pwrite, FIONBIO, &flag);
+    assert(r == 0);
+
+    pthread_t producer;
+    pthread_create(&producer, NULL, ring_produce_dogs, q);
+    pp.pread = pread;
+    pthread_create(&reader, NULL, pipe_consume, &pp);
+    bytes = total = 0;
+    remain = NULL;
+    int frames = 0;
+    while (frames < 50000 || remain) {
+        int written;
+        errno = 0;
+        bytes = nitro_queue_fd_write(
+            q, pwrite, remain, &remain, &written);
+        frames += written;
+        if (bytes > 0)
+            total += bytes;
+        else if (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            break;
+    }
     close(pwrite);
+    pthread_join(producer, &unused);
+    pthread_join(reader, &t_ret);
+    TEST("(ring fd write) correct write byte count",
+    total == pp.got);
+
+    TEST("(ring fd write) read data was correct",
+    count_dogs(out, out + pp.got, &batches) == 50000);
+
     close(pread);
+    nitro_queue_destroy(q);
 
+    /* Deadlines */
+    uint64_t expired = 0;
+    q = nitro_queue_new(0,
+    test_state_callback, &tstate);
+    q->stat_expired = &expired;
+    for (i=0; i < 4; i++) {
+        nitro_frame_t *df = nitro_frame_new_copy(&i, sizeof(int));
+        if (i != 2) {
+            nitro_frame_set_deadline(df, i == 3 ? 60 : 0.01);
+        }
+        nitro_queue_push(q, df, 0);
+    }
+    usleep(50000);
+    back = nitro_queue_pull(q, 0);
+    TEST("(deadline) expired frames skipped",
+        back && *(int*)nitro_frame_data(back) == 2 && expired == 2);
+    nitro_frame_destroy(back);
+    back = nitro_queue_pull(q, 0);
+    TEST("(deadline) unexpired deadline delivered",
+        back && *(int*)nitro_frame_data(back) == 3);
+    nitro_frame_destroy(back);
 
+    hello = nitro_frame_new_copy("hello", 6);
+    nitro_frame_set_deadline(hello, 0.01);
+    nitro_queue_push(q, hello, 0);
+    usleep(50000);
+    back = nitro_queue_pull_timeout(q, 0.1);
+    TEST("(deadline) only expired frames is a timeout",
+        back == NULL && expired == 3 && nitro_queue_count(q) == 0
+        && tstate.state_was == NITRO_QUEUE_STATE_EMPTY);
+
+    /* expired, live, expired: only the live one is written */
+    r = pipe(ps);
+    assert(!r);
+    for (i=0; i < 3; i++) {
+        nitro_frame_t *df = nitro_frame_new_copy("dog", 3);
+        if (i != 1) {
+            nitro_frame_set_deadline(df, 0.01);
+        }
+        nitro_queue_push(q, df, 0);
+    }
+    usleep(50000);
+    int written = 0;
+    remain = NULL;
+    bytes = nitro_queue_fd_write(q, ps[1], NULL, &remain, &written);
+    TEST("(deadline) fd write skips expired",
+        bytes == 11 && written == 1 && !remain);
+    bytes = nitro_queue_fd_write(q, ps[1], NULL, &remain, &written);
+    TEST("(deadline) ...even behind a live frame",
+        bytes == 0 && expired == 5 && nitro_queue_count(q) == 0);
+    close(ps[0]);
+    close(ps[1]);
+    nitro_queue_destroy(q);
+
+    q = nitro_queue_new_ring(8, NULL, NULL);
+    q->stat_expired = &expired;
+    hello = nitro_frame_new_copy("hello", 6);
+    nitro_frame_set_deadline(hello, 0.01);
+    nitro_queue_push(q, hello, 0);
+    nitro_queue_push(q, nitro_frame_new_copy("world", 6), 0);
+    usleep(50000);
+    back = nitro_queue_pull(q, 0);
+    TEST("(ring deadline) expired frame skipped",
+        back && !strcmp(nitro_frame_data(back), "world") && expired == 6);
+    nitro_frame_destroy(back);
+    nitro_queue_destroy(q);
+
+    /* Spill */
+    q = nitro_queue_new(4,
+    test_state_callback, &tstate);
+    nitro_queue_set_spill(q, "/tmp");
+    for (i=0; i < 1000; i++) {
+        if (nitro_queue_push(q, nitro_frame_new_copy(&i, sizeof(int)), 0)) {
+            break;
+        }
+    }
+    TEST("(spill) never full for pushers", i == 1000);
+    TEST("(spill) queue stays at capacity",
+        nitro_queue_count(q) == 4 && nitro_spill_count(q->spill) == 996);
+    r = nitro_queue_pull_batch(q, batch, 3, 0);
+    for (i=0; i < r; i++) {
+        nitro_frame_destroy(batch[i]);
+    }
+    TEST("(spill) refilled after pull",
+        nitro_queue_count(q) == 4 && nitro_spill_count(q->spill) == 993);
+    for (i=3; i < 1000; i++) {
+        back = nitro_queue_pull(q, 0);
+        int v = back ? *(int*)nitro_frame_data(back) : -1;
+        if (back) {
+            nitro_frame_destroy(back);
+        }
+        if (v != i) {
+            break;
+        }
+    }
+    TEST("(spill) drained in order",
+        i == 1000 && !nitro_spill_count(q->spill)
+        && tstate.state_was == NITRO_QUEUE_STATE_EMPTY);
+
+    /* spilled frames go out byte-for-byte as they would have */
+    r = pipe(ps);
+    assert(!r);
+    for (i=0; i < 10; i++) {
+        nitro_queue_push(q, nitro_frame_new_copy("dog", 3), 0);
+    }
+    written = 0;
+    total = 0;
+    remain = NULL;
+    while (nitro_queue_count(q)) {
+        bytes = nitro_queue_fd_write(q, ps[1], NULL, &remain, &written);
+        if (bytes <= 0) {
+            break;
+        }
+        total += bytes;
+    }
+    r = read(ps[0], out, 110);
+    TEST("(spill) fd write of spilled frames", total == r &&
+        count_dogs(out, out + r, &batches) == 10);
+    close(ps[0]);
+    close(ps[1]);
+    nitro_queue_destroy(q);
+
+    /* spill under sustained overload: a backlog of ~400KB
+       that never drains reuses the file instead of growing it */
+    q = nitro_queue_new(4, NULL, NULL);
+    nitro_queue_set_spill(q, "/tmp");
+    char slab[4096] = {0};
+    int next = 0, ok = 1;
+    for (i=0; i < 100; i++) {
+        memcpy(slab, &i, sizeof(int));
+        nitro_queue_push(q, nitro_frame_new_copy(slab, sizeof(slab)), 0);
+    }
+    for (; i < 2000; i++) {
+        memcpy(slab, &i, sizeof(int));
+        nitro_queue_push(q, nitro_frame_new_copy(slab, sizeof(slab)), 0);
+        back = nitro_queue_pull(q, 0);
+        ok = ok && back && *(int*)nitro_frame_data(back) == next++;
+        nitro_frame_destroy(back);
+    }
+    TEST("(spill ring) file space reused",
+        ok && nitro_spill_count(q->spill) == 96
+        && q->spill->size == NITRO_SPILL_INITIAL_SZ);
+
+    /* outgrow it while the records wrap around the end */
+    for (; i < 2400; i++) {
+        memcpy(slab, &i, sizeof(int));
+        nitro_queue_push(q, nitro_frame_new_copy(slab, sizeof(slab)), 0);
+    }
+    int grown = q->spill->size > NITRO_SPILL_INITIAL_SZ;
+    while ((back = nitro_queue_pull(q, 0))) {
+        ok = ok && *(int*)nitro_frame_data(back) == next++;
+        nitro_frame_destroy(back);
+    }
+    TEST("(spill ring) grows with wrapped records in order",
+        ok && grown && next == 2400 && !nitro_spill_count(q->spill)
+        && q->spill->size == NITRO_SPILL_INITIAL_SZ);
     nitro_queue_destroy(q);
 
     SUMMARY(0);
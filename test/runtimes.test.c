@@ -0,0 +1,83 @@
+#include "test.h"
+#include "nitro.h"
+
+static int round_trip(nitro_socket_t *r, nitro_socket_t *c, int count) {
+    int i;
+
+    for (i=0; i < count; i++) {
+        nitro_frame_t *fr = nitro_frame_new_copy(&i, sizeof(int));
+        nitro_send(&fr, c, 0);
+
+        fr = nitro_recv(r, 0);
+        if (*(int*)nitro_frame_data(fr) != i) {
+            nitro_frame_destroy(fr);
+            break;
+        }
+
+        nitro_frame_t *back = nitro_frame_new_copy(&i, sizeof(int));
+        nitro_reply(fr, &back, r, 0);
+        nitro_frame_destroy(fr);
+
+        fr = nitro_recv(c, 0);
+        if (*(int*)nitro_frame_data(fr) != i) {
+            nitro_frame_destroy(fr);
+            break;
+        }
+        nitro_frame_destroy(fr);
+    }
+
+    return i;
+}
+
+int main(int argc, char **argv) {
+    nitro_runtime_start();
+
+    nitro_runtime_t *a = nitro_runtime_new(1);
+    nitro_runtime_t *b = nitro_runtime_new(2);
+
+    TEST("runtimes are distinct", a != b && a != the_runtime);
+
+    nitro_socket_t *ab = nitro_runtime_socket_bind(a, "inproc://shared", NULL);
+    nitro_socket_t *bb = nitro_runtime_socket_bind(b, "inproc://shared", NULL);
+    TEST("same inproc name binds in two runtimes", ab && bb);
+
+    nitro_socket_t *db = nitro_socket_bind("inproc://shared", NULL);
+    TEST("...and in the default runtime", db != NULL);
+
+    nitro_socket_t *orphan = nitro_runtime_socket_connect(a, "inproc://only-b", NULL);
+    TEST("inproc namespace is per runtime", orphan == NULL &&
+        nitro_error() == NITRO_ERR_INPROC_NOT_BOUND);
+
+    nitro_socket_t *ac = nitro_runtime_socket_connect(a, "inproc://shared", NULL);
+    TEST("inproc round trips on runtime a", round_trip(ab, ac, 1000) == 1000);
+    TEST("sockets counted per runtime", a->num_sock == 2 && b->num_sock == 1);
+
+    nitro_socket_t *tb = nitro_runtime_socket_bind(b, "tcp://127.0.0.1:4447", NULL);
+    nitro_socket_t *tc = nitro_runtime_socket_connect(b, "tcp://127.0.0.1:4447", NULL);
+    TEST("tcp round trips on runtime b", round_trip(tb, tc, 1000) == 1000);
+
+    nitro_socket_close(ab);
+    nitro_socket_close(ac);
+    nitro_socket_close(bb);
+    nitro_socket_close(db);
+    nitro_socket_close(tb);
+    nitro_socket_close(tc);
+
+    /* linger */
+    sleep(2);
+
+    TEST("all sockets gone", a->num_sock == 0 && b->num_sock == 0 &&
+        the_runtime->num_sock == 0);
+
+    nitro_runtime_destroy(a);
+    nitro_runtime_destroy(b);
+
+    nitro_socket_t *still = nitro_socket_bind("inproc://after", NULL);
+    TEST("default runtime survives others", still != NULL);
+    nitro_socket_close(still);
+
+    nitro_runtime_stop();
+
+    SUMMARY(0);
+    return 1;
+}